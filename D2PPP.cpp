@@ -5,12 +5,14 @@
 #include <TH1F.h>
 #include <TH2F.h>
 #include <TGraph.h>
+#include <TGraphErrors.h>
 #include <TLegend.h>
 #include <TMath.h>
 #include <TRandom.h>
 #include <TRandom3.h>
 #include <TTree.h>
 #include <TROOT.h>
+#include <TStyle.h>
 #include <TMinuit.h>
 #include <TNtuple.h>
 #include <TComplex.h>
@@ -20,9 +22,32 @@
 
 // System stuff
 #include <CLI/Timer.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <future>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <string>
 
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef D2PPP_MPI
+#include <mpi.h>
+#endif
+
 // GooFit stuff
 #include <goofit/Application.h>
 #include <goofit/BinnedDataSet.h>
@@ -43,8 +68,19 @@
 #include <goofit/PDFs/combine/CompositePdf.h>
 #include <goofit/PDFs/physics/IncoherentSumPdf.h>
 
+#include <Minuit2/FCNGradientBase.h>
+#include <Minuit2/FunctionMinimum.h>
+#include <Minuit2/MnMigrad.h>
+#include <Minuit2/MnPrint.h>
+#include <Minuit2/MnUserParameters.h>
+
 #include <thrust/transform_reduce.h>
 
+// Local stuff
+#include "FitTrace.h"
+#include "MIPWALikelihood.h"
+#include "D2PPP.h"
+
 using namespace std;
 using namespace GooFit;
 using namespace ROOT;
@@ -64,6 +100,8 @@ bool saveEffPlot= true;
 bool doEffSwap  = true;
 bool toyOn      = false;
 bool bkgOn      = false;
+bool templateCacheOn = true;
+bool symmetricOn = false; // fit --quadNorm: integrate the identical-pion Dalitz plot over s12 <= s13
 
 const double NevG = 1e7; 
 
@@ -90,16 +128,40 @@ Variable massSum("massSum", POW2(D_MASS) + POW2(d1_MASS) + POW2(d2_MASS) + POW2(
 
 
 // PWA INPUT FILE NAME
-const string pwa_file = "files/PWACOEFS.txt";
+string pwa_file = "files/PWACOEFS.txt";
 
 // Data File
 const string data_name = "files/DsPPP_TIS_PosTS_par_sPloted_large__MVA.root";
 const string tree_name = "sTree";
 
+// Built efficiency/background templates
+string template_cache_dir = "cache";
+
+// Entry range, selection and I/O threads used when reading the data tree
+TreeSelection data_selection;
+
+// Per-event weight branch of the data tree (e.g. sWeights; empty: unweighted) and the weights
+// getdata() read, in dataset order
+string weight_branch;
+std::vector<double> event_weights;
+
+// With several MPI processes Data holds events [data_first_event, data_first_event + N) of
+// data_total_events; otherwise all of them
+size_t data_first_event  = 0;
+size_t data_total_events = 0;
+
+// Migrad checkpoints and warm start
+FitCheckpointing fit_checkpointing;
+
+// Multi-start MIPWA fits (--quadNorm)
+MultiStart multi_start;
+
+// Storage precision of the host likelihood tables (--quadNorm)
+FitPrecision fit_precision;
+
 //functions
 fptype cpuGetM23(fptype massPZ, fptype massPM) { return (massSum.getValue() - massPZ - massPM); }
 
-DalitzPlotPdf *makesignalpdf(GooPdf *eff = 0);
 void getdata(std::string name);
 
 TH2F *weightHistogram    = nullptr;
@@ -113,7 +175,669 @@ TH2F *underlyingBins     = nullptr;
 
 
 
-void maketoydalitzdata(GooPdf* overallsignal,std::string name, size_t nEvents){
+// Binary event files: a header, one descriptor per observable, then one contiguous
+// column of doubles per observable in descriptor order
+struct EventFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nObs;
+    uint64_t nEvents;
+};
+
+struct EventFileObservable {
+    char name[48];
+    double lower;
+    double upper;
+};
+
+const char event_file_magic[8] = {'D', '2', 'P', 'P', 'P', 'E', 'V', 'T'};
+
+bool isEventFile(const std::string &name){
+
+    char magic[8] = {0};
+    std::ifstream reader(name.c_str(), std::ios::binary);
+    reader.read(magic, sizeof(magic));
+    return reader.good() && memcmp(magic, event_file_magic, sizeof(magic)) == 0;
+}
+
+// Adds n events to data, taking observable k from columns[k]
+void fillDataSet(UnbinnedDataSet *data, std::vector<Observable> obs, const std::vector<const double *> &columns, size_t n){
+
+    for(size_t i = 0; i < n; i++) {
+        for(size_t k = 0; k < obs.size(); k++)
+            obs[k].setValue(columns[k][i]);
+        data->addEvent();
+    }
+}
+
+void writeEventFile(const std::string &name, const std::vector<Observable> &obs, const std::vector<std::vector<double>> &columns){
+
+    EventFileHeader header;
+    memcpy(header.magic, event_file_magic, sizeof(header.magic));
+    header.version = 1;
+    header.nObs    = obs.size();
+    header.nEvents = columns.empty() ? 0 : columns[0].size();
+
+    FILE *out = fopen(name.c_str(), "wb");
+    if(!out)
+        throw GooFit::GeneralError("Cannot open {} for writing", name);
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for(const Observable &o : obs) {
+        EventFileObservable desc;
+        memset(&desc, 0, sizeof(desc));
+        strncpy(desc.name, o.getName().c_str(), sizeof(desc.name) - 1);
+        desc.lower = o.getLowerLimit();
+        desc.upper = o.getUpperLimit();
+        ok = ok && fwrite(&desc, sizeof(desc), 1, out) == 1;
+    }
+    for(const auto &column : columns)
+        ok = ok && fwrite(column.data(), sizeof(double), column.size(), out) == column.size();
+
+    if(fclose(out) != 0 || !ok)
+        throw GooFit::GeneralError("Failed writing event file {}", name);
+}
+
+// Maps an event file and copies out the columns of the requested observables (matched by
+// name). A missing `indexName` column is filled with the event index. Touches no GooFit
+// objects, so it can run on any thread.
+std::vector<std::vector<double>> readEventColumns(const std::string &name, const std::vector<std::string> &names,
+                                                  const std::string &indexName = ""){
+
+    int fd = ::open(name.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0)
+        throw GooFit::GeneralError("Cannot open event file {}", name);
+
+    size_t size = st.st_size;
+    if(size < sizeof(EventFileHeader)) {
+        ::close(fd);
+        throw GooFit::GeneralError("{} is not a valid event file", name);
+    }
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED)
+        throw GooFit::GeneralError("Cannot map event file {}", name);
+
+    const EventFileHeader *header = static_cast<const EventFileHeader *>(map);
+    auto invalid                  = [&]() {
+        munmap(map, size);
+        return GooFit::GeneralError("{} is not a valid event file", name);
+    };
+    if(memcmp(header->magic, event_file_magic, sizeof(header->magic)) != 0 || header->version != 1)
+        throw invalid();
+
+    // The column layout is taken from the header only once the descriptors fit in the file,
+    // and the payload size is checked by division so no product of header fields can overflow
+    size_t payloadOffset = sizeof(EventFileHeader) + size_t(header->nObs) * sizeof(EventFileObservable);
+    if(size < payloadOffset)
+        throw invalid();
+    size_t payloadSize = size - payloadOffset;
+    size_t eventSize   = size_t(header->nObs) * sizeof(double);
+    if(eventSize == 0 ? payloadSize != 0 : (payloadSize % eventSize != 0 || payloadSize / eventSize != header->nEvents))
+        throw invalid();
+
+    const EventFileObservable *descs = reinterpret_cast<const EventFileObservable *>(header + 1);
+    const double *payload            = reinterpret_cast<const double *>(descs + header->nObs);
+
+    size_t nEvents = header->nEvents;
+    std::vector<std::vector<double>> columns;
+
+    for(const std::string &o : names) {
+        const double *column = nullptr;
+        for(uint32_t k = 0; k < header->nObs; k++)
+            if(o == descs[k].name)
+                column = payload + k * nEvents;
+
+        if(column)
+            columns.emplace_back(column, column + nEvents);
+        else if(!indexName.empty() && o == indexName) {
+            columns.emplace_back(nEvents);
+            for(size_t i = 0; i < nEvents; i++)
+                columns.back()[i] = i;
+        } else {
+            munmap(map, size);
+            throw GooFit::GeneralError("Observable {} not found in {}", o, name);
+        }
+    }
+
+    munmap(map, size);
+    return columns;
+}
+
+// Loads the requested observables of an event file into a new dataset
+UnbinnedDataSet *readEventFile(const std::string &name, const std::vector<Observable> &obs){
+
+    std::vector<std::string> names;
+    for(const Observable &o : obs)
+        names.push_back(o.getName());
+    auto columns = readEventColumns(name, names, eventNumber.getName());
+
+    std::vector<const double *> ptrs;
+    for(const auto &column : columns)
+        ptrs.push_back(column.data());
+
+    UnbinnedDataSet *data = new UnbinnedDataSet(obs);
+    fillDataSet(data, obs, ptrs, columns[0].size());
+    return data;
+}
+
+// The s12 and s13 columns of a toy: an event file (columns `names`), or the "eventNumber s12
+// s13" text of older toys. Like readEventColumns() it can run on any thread.
+std::vector<std::vector<double>> readToyColumns(const std::string &name, const std::vector<std::string> &names){
+
+    if(isEventFile(name))
+        return readEventColumns(name, names);
+
+    std::vector<std::vector<double>> columns(2);
+    std::ifstream reader(name.c_str());
+    double n, x, y;
+    while(reader >> n >> x >> y) {
+        columns[0].push_back(x);
+        columns[1].push_back(y);
+    }
+    return columns;
+}
+
+UnbinnedDataSet *readToyFile(const std::string &name){
+
+    auto columns = readToyColumns(name, {s12.getName(), s13.getName()});
+    size_t n     = columns[0].size();
+    std::vector<double> index(n);
+    for(size_t i = 0; i < n; i++)
+        index[i] = i;
+
+    UnbinnedDataSet *data = new UnbinnedDataSet({s12,s13,eventNumber});
+    fillDataSet(data, {s12, s13, eventNumber}, {columns[0].data(), columns[1].data(), index.data()}, n);
+    return data;
+}
+
+// Reads the given branches (or formulas) of a tree in one pass and returns one column per
+// expression. Baskets go through a TTreeCache with parallel unzipping, so the selected
+// branches are fetched in bulk and decompressed on ROOT's I/O threads; the caller enables
+// implicit MT first (see dataSource()), as that must happen on the main thread.
+std::vector<std::vector<double>> readTreeColumns(const string &fname, const string &tname,
+                                                 const std::vector<string> &exprs, const TreeSelection &sel){
+
+    if(exprs.empty() || exprs.size() > 4)
+        throw GooFit::GeneralError("readTreeColumns supports 1 to 4 columns, got {}", exprs.size());
+
+    std::unique_ptr<TFile> f(TFile::Open(fname.c_str()));
+    if(!f || f->IsZombie())
+        throw GooFit::GeneralError("Cannot open {}", fname);
+    TTree *t = (TTree *)f->Get(tname.c_str());
+    if(!t)
+        throw GooFit::GeneralError("No tree {} in {}", tname, fname);
+
+    Long64_t total = t->GetEntries();
+    Long64_t first = std::min(sel.firstEntry, total);
+    Long64_t n     = sel.nEntries < 0 ? total - first : std::min(sel.nEntries, total - first);
+    if(sel.parts > 1) {
+        Long64_t begin = first + n * sel.part / sel.parts;
+        n              = first + n * (sel.part + 1) / sel.parts - begin;
+        first          = begin;
+    }
+    // Without a cut every scanned entry is selected, so the limit bounds the scan itself
+    if(sel.cut.empty() && sel.maxEvents >= 0 && sel.parts == 1)
+        n = std::min(n, sel.maxEvents);
+
+    t->SetCacheSize(256 * 1024 * 1024);
+    for(const string &e : exprs)
+        if(t->GetBranch(e.c_str()))
+            t->AddBranchToCache(e.c_str(), true);
+    t->SetParallelUnzip(sel.threads != 1);
+
+    string varexp = exprs[0];
+    for(size_t k = 1; k < exprs.size(); k++)
+        varexp += ":" + exprs[k];
+
+    t->SetEstimate(std::max<Long64_t>(n, 1));
+    Long64_t rows = n > 0 ? t->Draw(varexp.c_str(), sel.cut.c_str(), "goff", n, first) : 0;
+    if(rows < 0)
+        throw GooFit::GeneralError("Cannot evaluate \"{}\" with cut \"{}\" on {}", varexp, sel.cut, tname);
+    if(sel.maxEvents >= 0 && sel.parts == 1)
+        rows = std::min(rows, sel.maxEvents);
+
+    std::vector<std::vector<double>> columns(exprs.size());
+    for(size_t k = 0; k < exprs.size(); k++) {
+        const double *v = t->GetVal(k);
+        columns[k].assign(v, v + rows);
+    }
+
+    return columns;
+}
+
+int mpiRank(){
+#ifdef D2PPP_MPI
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    return rank;
+#else
+    return 0;
+#endif
+}
+
+int mpiSize(){
+#ifdef D2PPP_MPI
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    return size;
+#else
+    return 1;
+#endif
+}
+
+// Events [first, last) of total held by process `rank`: an even share of whole likelihood
+// blocks, so the per-block sums are those of a single process
+void ownedEvents(size_t total, int rank, int size, size_t &first, size_t &last){
+
+    size_t bs      = MIPWALikelihood::eventBlockSize();
+    size_t nBlocks = (total + bs - 1) / bs;
+    first          = std::min(total, nBlocks * rank / size * bs);
+    last           = std::min(total, nBlocks * (rank + 1) / size * bs);
+}
+
+#ifdef D2PPP_MPI
+// Block exchange of the host likelihood over MPI_COMM_WORLD
+class MPIExchange : public BlockExchange {
+  public:
+    int rank() const override { return mpiRank(); }
+    int size() const override { return mpiSize(); }
+
+    void gather(double *data, size_t, size_t width, size_t first, size_t count) const override {
+        int n      = size();
+        long own[2] = {(long)first, (long)count};
+        std::vector<long> all(2 * n);
+        MPI_Allgather(own, 2, MPI_LONG, all.data(), 2, MPI_LONG, MPI_COMM_WORLD);
+
+        std::vector<int> counts(n), displs(n);
+        for(int r = 0; r < n; r++) {
+            displs[r] = all[2 * r] * width;
+            counts[r] = all[2 * r + 1] * width;
+        }
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, data, counts.data(), displs.data(), MPI_DOUBLE,
+                       MPI_COMM_WORLD);
+    }
+
+    void sum(double *data, size_t n) const override {
+        MPI_Allreduce(MPI_IN_PLACE, data, n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    }
+};
+
+// Moves the rows each process read (its share of the entries, in entry order) so that each
+// holds its ownedEvents() range [first, first + rows) of total, keeping the first maxEvents
+// rows overall (-1: all)
+void redistributeRows(std::vector<std::vector<double>> &columns, Long64_t maxEvents, size_t &first, size_t &total){
+
+    int rank = mpiRank(), size = mpiSize();
+    long rows = columns[0].size();
+    std::vector<long> read(size);
+    MPI_Allgather(&rows, 1, MPI_LONG, read.data(), 1, MPI_LONG, MPI_COMM_WORLD);
+
+    // Rows kept per process and their global offsets
+    std::vector<size_t> offset(size + 1, 0);
+    for(int r = 0; r < size; r++)
+        offset[r + 1] = offset[r] + read[r];
+    total = maxEvents >= 0 ? std::min<size_t>(offset[size], maxEvents) : offset[size];
+    for(int r = 0; r <= size; r++)
+        offset[r] = std::min(offset[r], total);
+
+    auto overlap = [](size_t a0, size_t a1, size_t b0, size_t b1) {
+        return std::max(a0, b0) < std::min(a1, b1) ? std::min(a1, b1) - std::max(a0, b0) : 0;
+    };
+
+    size_t last;
+    ownedEvents(total, rank, size, first, last);
+
+    std::vector<int> sendCounts(size), sendDispls(size), recvCounts(size), recvDispls(size);
+    for(int r = 0; r < size; r++) {
+        size_t f, l;
+        ownedEvents(total, r, size, f, l);
+        sendCounts[r] = overlap(offset[rank], offset[rank + 1], f, l);
+        sendDispls[r] = std::max(offset[rank], f) - offset[rank];
+        recvCounts[r] = overlap(offset[r], offset[r + 1], first, last);
+        recvDispls[r] = std::max(offset[r], first) - first;
+    }
+
+    for(auto &column : columns) {
+        std::vector<double> owned(last - first);
+        MPI_Alltoallv(column.data(), sendCounts.data(), sendDispls.data(), MPI_DOUBLE, owned.data(),
+                      recvCounts.data(), recvDispls.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+        column = std::move(owned);
+    }
+}
+
+// The rows of all processes, in order, on rank 0 (empty elsewhere)
+std::vector<double> gatherRows(const std::vector<double> &column){
+
+    int size = mpiSize();
+    int rows = column.size();
+    std::vector<int> counts(size), displs(size, 0);
+    MPI_Gather(&rows, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    for(int r = 1; r < size; r++)
+        displs[r] = displs[r - 1] + counts[r - 1];
+
+    std::vector<double> all(mpiRank() == 0 ? displs[size - 1] + counts[size - 1] : 0);
+    MPI_Gatherv(column.data(), rows, MPI_DOUBLE, all.data(), counts.data(), displs.data(), MPI_DOUBLE, 0,
+                MPI_COMM_WORLD);
+    return all;
+}
+#endif
+
+// Thread placement for the OpenMP backend: "compact" fills one socket before the next,
+// "scatter" alternates sockets, "none" leaves placement to the OS. Each OpenMP worker pins
+// itself to one CPU of the main thread's affinity mask, taking sockets from /sys. Threads
+// first-touch the buffers they fill, so pinning also keeps each event block on the node that
+// reads it. The main thread (OpenMP thread 0) keeps its mask: threads started later, such as
+// ROOT's I/O pool or the startup reader, inherit it and would otherwise share one CPU. Call
+// again after changing the thread count.
+void pinThreads(const string &mode){
+
+    if(mode == "none")
+        return;
+    if(mode != "compact" && mode != "scatter")
+        throw GooFit::GeneralError("Unknown --pin mode {}, use none, compact or scatter", mode);
+
+#ifdef _OPENMP
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        GOOFIT_WARN("Cannot read the CPU affinity mask, threads are not pinned");
+        return;
+    }
+
+    struct Cpu {
+        int id, socket, rank; // rank: index of the CPU within its socket
+    };
+    std::vector<Cpu> cpus;
+    std::map<int, int> perSocket;
+    for(int c = 0; c < CPU_SETSIZE; c++) {
+        if(!CPU_ISSET(c, &allowed))
+            continue;
+        int socket = 0;
+        std::ifstream topology(fmt::format("/sys/devices/system/cpu/cpu{}/topology/physical_package_id", c));
+        topology >> socket;
+        cpus.push_back({c, socket, perSocket[socket]++});
+    }
+    std::stable_sort(cpus.begin(), cpus.end(), [&](const Cpu &a, const Cpu &b) {
+        return mode == "compact" ? std::make_pair(a.socket, a.id) < std::make_pair(b.socket, b.id)
+                                 : std::make_pair(a.rank, a.socket) < std::make_pair(b.rank, b.socket);
+    });
+
+#pragma omp parallel
+    if(omp_get_thread_num() > 0) {
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpus[omp_get_thread_num() % cpus.size()].id, &one);
+        sched_setaffinity(0, sizeof(one), &one);
+    }
+
+    GOOFIT_INFO("Pinned {} worker threads ({}) over {} CPUs on {} socket(s)", omp_get_max_threads() - 1, mode, cpus.size(),
+                perSocket.size());
+#else
+    GOOFIT_WARN("--pin needs an OpenMP build, threads are not pinned");
+#endif
+}
+
+// Device memory of the DalitzPlotPdf per-event wave cache (one complex per resonance and event)
+void traceCachedWaves(size_t nEvents){
+
+    FitTrace::instance().memory("cached waves",
+                                signaldalitz->getDecayInfo().resonances.size() * nEvents * sizeof(std::complex<fptype>));
+}
+
+// Probabilities of component `component` of pdf at the points (x[k], y[k]). GooFit evaluates
+// a PDF on the dataset attached to it, so this attaches a scratch dataset that is gone on
+// return; callers save pdf->getData() first and hand it back with restorePdfData().
+std::vector<double> evaluatePdfAt(GooPdf *pdf, const double *x, const double *y, size_t n, size_t component = 0){
+
+    std::vector<double> evts(n);
+    for(size_t k = 0; k < n; k++)
+        evts[k] = k;
+
+    std::vector<Observable> vars = {s12, s13, eventNumber};
+    UnbinnedDataSet points(vars);
+    fillDataSet(&points, vars, {x, y, evts.data()}, n);
+    pdf->setData(&points);
+    signaldalitz->setDataSize(points.getNumEvents());
+    traceCachedWaves(points.getNumEvents());
+
+    FitTrace::Scope scope("evaluate points");
+    return pdf->getCompProbsAtDataPoints()[component];
+}
+
+// Re-attaches the dataset pdf had before evaluatePdfAt(), if it had one
+void restorePdfData(GooPdf *pdf, DataSet *data){
+
+    if(!data)
+        return;
+    pdf->setData(data);
+    signaldalitz->setDataSize(data->getNumEvents());
+    traceCachedWaves(data->getNumEvents());
+}
+
+// Binned projections of a PDF over the s12 x s13 bin-centre grid
+struct DalitzProjections {
+    size_t nx = 0, ny = 0;
+    std::vector<double> s12, s13, s23; // s23 uses the s13 binning
+    std::vector<double> dalitz;        // nx * ny, s13 fastest
+    double total = 0;
+};
+
+// Evaluates component `component` of pdf on the in-Dalitz bin centres of the s12 x s13 grid
+// and reduces straight into the 1D/2D projections. The grid goes through the device in
+// chunks of chunkSize points, so only one chunk of probabilities is on the host at a time;
+// each grid point is its own Dalitz bin, so the scatter and the reductions run in parallel
+// over rows. The PDF is handed back its own dataset afterwards.
+DalitzProjections projectPdf(GooPdf *pdf, size_t component = 0, size_t chunkSize = 1 << 18){
+
+    DalitzProjections proj;
+    proj.nx = s12.getNumBins();
+    proj.ny = s13.getNumBins();
+    proj.dalitz.assign(proj.nx * proj.ny, 0.0);
+
+    const double x0 = s12.getLowerLimit(), dx = (s12.getUpperLimit() - x0) / proj.nx;
+    const double y0 = s13.getLowerLimit(), dy = (s13.getUpperLimit() - y0) / proj.ny;
+
+    DataSet *fitData = pdf->getData();
+    std::vector<double> xs, ys;
+    std::vector<size_t> bins;
+    xs.reserve(chunkSize);
+    ys.reserve(chunkSize);
+    bins.reserve(chunkSize);
+
+    auto flush = [&]() {
+        if(bins.empty())
+            return;
+        std::vector<double> v = evaluatePdfAt(pdf, xs.data(), ys.data(), bins.size(), component);
+#pragma omp parallel for
+        for(long k = 0; k < (long)bins.size(); k++)
+            proj.dalitz[bins[k]] = v[k];
+        xs.clear();
+        ys.clear();
+        bins.clear();
+    };
+
+    for(size_t i = 0; i < proj.nx; ++i) {
+        double x = x0 + dx * (i + 0.5);
+        for(size_t j = 0; j < proj.ny; ++j) {
+            double y = y0 + dy * (j + 0.5);
+            if(!inDalitz(x, y, D_MASS, d1_MASS, d2_MASS, d3_MASS))
+                continue;
+            xs.push_back(x);
+            ys.push_back(y);
+            bins.push_back(i * proj.ny + j);
+            if(bins.size() == chunkSize)
+                flush();
+        }
+    }
+    flush();
+    restorePdfData(pdf, fitData);
+
+    // s12 rows are owned by one thread; s13/s23 are summed per thread and merged
+    proj.s12.assign(proj.nx, 0.0);
+    proj.s13.assign(proj.ny, 0.0);
+    proj.s23.assign(proj.ny, 0.0);
+    double total = 0;
+#pragma omp parallel reduction(+ : total)
+    {
+        std::vector<double> s13Local(proj.ny, 0.0), s23Local(proj.ny, 0.0);
+#pragma omp for schedule(static) nowait
+        for(long i = 0; i < (long)proj.nx; ++i) {
+            double x = x0 + dx * (i + 0.5);
+            for(size_t j = 0; j < proj.ny; ++j) {
+                double v = proj.dalitz[i * proj.ny + j];
+                if(v == 0)
+                    continue;
+                proj.s12[i] += v;
+                s13Local[j] += v;
+                double m23 = cpuGetM23(x, y0 + dy * (j + 0.5));
+                if(m23 >= y0 && m23 < y0 + dy * proj.ny)
+                    s23Local[size_t((m23 - y0) / dy)] += v;
+                total += v;
+            }
+        }
+#pragma omp critical
+        for(size_t j = 0; j < proj.ny; ++j) {
+            proj.s13[j] += s13Local[j];
+            proj.s23[j] += s23Local[j];
+        }
+    }
+    proj.total = total;
+
+    return proj;
+}
+
+// Philox4x32-10 (Salmon et al., SC11): four uniform 32-bit words per (key, counter), with no
+// state to carry between threads.
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]){
+
+    uint32_t c[4] = {counter[0], counter[1], counter[2], counter[3]};
+    uint32_t k[2] = {key[0], key[1]};
+    for(int round = 0; round < 10; round++) {
+        uint64_t p0 = uint64_t(0xD2511F53) * c[0];
+        uint64_t p1 = uint64_t(0xCD9E8D57) * c[2];
+        uint32_t next[4] = {uint32_t(p1 >> 32) ^ c[1] ^ k[0], uint32_t(p1), uint32_t(p0 >> 32) ^ c[3] ^ k[1],
+                            uint32_t(p0)};
+        memcpy(c, next, sizeof(c));
+        k[0] += 0x9E3779B9;
+        k[1] += 0xBB67AE85;
+    }
+    memcpy(out, c, sizeof(c));
+}
+
+ToyGenerator::ToyGenerator(GooPdf *pdf, size_t cellBins, double safety)
+    : pdf_(pdf) {
+
+    DalitzProjections grid = projectPdf(pdf);
+
+    // Cells of cellBins x cellBins grid bins; the last row/column may reach past the limits
+    nx_ = (grid.nx + cellBins - 1) / cellBins;
+    ny_ = (grid.ny + cellBins - 1) / cellBins;
+    x0_ = s12.getLowerLimit();
+    y0_ = s13.getLowerLimit();
+    dx_ = cellBins * (s12.getUpperLimit() - x0_) / grid.nx;
+    dy_ = cellBins * (s13.getUpperLimit() - y0_) / grid.ny;
+
+    envelope_.assign(nx_ * ny_, 0.0);
+#pragma omp parallel for
+    for(long c = 0; c < (long)(nx_ * ny_); c++) {
+        long ci = c / ny_, cj = c % ny_;
+        long i0 = std::max<long>(0, ci * cellBins - 1), i1 = std::min<long>(grid.nx, (ci + 1) * cellBins + 1);
+        long j0 = std::max<long>(0, cj * cellBins - 1), j1 = std::min<long>(grid.ny, (cj + 1) * cellBins + 1);
+        double m = 0;
+        for(long i = i0; i < i1; i++)
+            for(long j = j0; j < j1; j++)
+                m = std::max(m, grid.dalitz[i * grid.ny + j]);
+        envelope_[c] = safety * m;
+    }
+}
+
+void ToyGenerator::generate(size_t nEvents, uint32_t seed, uint32_t stream, std::vector<double> &x, std::vector<double> &y){
+
+    const uint32_t key[2] = {seed, stream};
+    const double xmax = s12.getUpperLimit();
+    const double ymax = s13.getUpperLimit();
+    DataSet *fitData  = pdf_->getData();
+
+    for(;;) {
+        std::vector<double> cumulative(envelope_.size());
+        double sum = 0;
+        for(size_t c = 0; c < envelope_.size(); c++)
+            cumulative[c] = sum += envelope_[c];
+        if(sum <= 0)
+            throw GooFit::GeneralError("The PDF is zero everywhere on the generation grid");
+
+        x.clear();
+        y.clear();
+        std::map<size_t, double> exceeded; // cell -> largest PDF / envelope above 1
+        uint64_t counter = 0;
+
+        while(x.size() < nEvents && exceeded.empty()) {
+            const size_t batch = std::min<size_t>(1 << 22, std::max<size_t>(1 << 18, 2 * (nEvents - x.size())));
+            std::vector<double> px(batch), py(batch), pu(batch);
+            std::vector<uint32_t> cell(batch);
+            std::vector<char> inside(batch);
+
+#pragma omp parallel for
+            for(long k = 0; k < (long)batch; k++) {
+                uint64_t n = counter + k;
+                const uint32_t ctr[4] = {uint32_t(n), uint32_t(n >> 32), 0, 0};
+                uint32_t r[4];
+                philox4x32(ctr, key, r);
+
+                double u[4];
+                for(int j = 0; j < 4; j++)
+                    u[j] = (r[j] + 0.5) * (1.0 / 4294967296.0);
+
+                size_t c = std::upper_bound(cumulative.begin(), cumulative.end(), u[0] * sum) - cumulative.begin();
+                c        = std::min(c, envelope_.size() - 1);
+                cell[k]  = c;
+                px[k]    = x0_ + dx_ * (c / ny_ + u[1]);
+                py[k]    = y0_ + dy_ * (c % ny_ + u[2]);
+                pu[k]    = u[3] * envelope_[c];
+                inside[k] = px[k] < xmax && py[k] < ymax && inDalitz(px[k], py[k], D_MASS, d1_MASS, d2_MASS, d3_MASS);
+            }
+            counter += batch;
+
+            // Only proposals inside the phase space go to the PDF, in proposal order
+            std::vector<size_t> keep;
+            for(size_t k = 0; k < batch; k++)
+                if(inside[k])
+                    keep.push_back(k);
+            std::vector<double> kx(keep.size()), ky(keep.size());
+            for(size_t k = 0; k < keep.size(); k++) {
+                kx[k] = px[keep[k]];
+                ky[k] = py[keep[k]];
+            }
+            std::vector<double> v = evaluatePdfAt(pdf_, kx.data(), ky.data(), keep.size());
+
+            for(size_t k = 0; k < keep.size() && x.size() < nEvents; k++) {
+                double env = envelope_[cell[keep[k]]];
+                if(v[k] > env) {
+                    double &ratio = exceeded[cell[keep[k]]];
+                    ratio         = std::max(ratio, v[k] / env);
+                }
+                if(pu[keep[k]] < v[k]) {
+                    x.push_back(kx[k]);
+                    y.push_back(ky[k]);
+                }
+            }
+        }
+
+        if(exceeded.empty()) {
+            restorePdfData(pdf_, fitData);
+            return;
+        }
+
+        // Raise only the cells that were exceeded; the other cells keep their acceptance
+        for(const auto &cell : exceeded) {
+            GOOFIT_WARN("PDF exceeds the generation envelope by {} in cell {}, regenerating", cell.second, cell.first);
+            envelope_[cell.first] *= 1.1 * cell.second;
+        }
+    }
+}
+
+void maketoydalitzdata(GooPdf* overallsignal,std::string name, size_t nEvents, std::string textname = "", uint32_t seed = 0){
 
 DalitzPlotter dp(overallsignal,signaldalitz);
 
@@ -132,25 +856,41 @@ Data = new UnbinnedDataSet({s12,s13,eventNumber});
         std::cout << "PDF plotted" << '\n';
     }
 
-        dp.fillDataSetMC(*Data,nEvents);
+        std::vector<std::vector<double>> columns(3);
+        {
+            FitTrace::Scope scope("generate");
+            ToyGenerator generator(overallsignal);
+            generator.generate(nEvents, seed, 0, columns[0], columns[1]);
+        }
         TH2F th2("toyData", "", 200, s12.getLowerLimit(), s12.getUpperLimit(), 200, s13.getLowerLimit(),
                          s13.getUpperLimit());
     th2.GetXaxis()->SetTitle("#pi^{-}#pi^{+} [Gev/c^{2}]");
     th2.GetYaxis()->SetTitle("#pi^{-}#pi^{+} [Gev/c^{2}]");
 
     {
-        ofstream w(name);
-
-            for (size_t i = 0; i < Data->getNumEvents(); i++) {
-                Data->loadEvent(i);
-                th2.Fill(s12, s13);
-                w << i << "\t" << std::setprecision(6) << s12.getValue() << "\t" << s13.getValue() << '\n';
+        size_t n = columns[0].size();
+        columns[2].resize(n);
 
+            for (size_t i = 0; i < n; i++) {
+                columns[2][i] = i;
+                th2.Fill(columns[0][i], columns[1][i]);
             }
 
-            std::cout << "nEvents generated = " << Data->getNumEvents() << '\n';
+            fillDataSet(Data, {s12, s13, eventNumber}, {columns[0].data(), columns[1].data(), columns[2].data()}, n);
+            // The generator evaluated the PDF on scratch points; the toy is its dataset now
+            overallsignal->setData(Data);
+            signaldalitz->setDataSize(n);
+
+            writeEventFile(name, {s12, s13, eventNumber}, columns);
+
+            if(!textname.empty()) {
+                ofstream w(textname);
+                for(size_t i = 0; i < n; i++)
+                    w << i << "\t" << std::setprecision(6) << columns[0][i] << "\t" << columns[1][i] << '\n';
+                w.close();
+            }
 
-        w.close();
+            std::cout << "nEvents generated = " << n << '\n';
 
     }
 
@@ -210,6 +950,272 @@ ResonancePdf *loadPWAResonance(const string fname = pwa_file, bool fixAmp = fals
 } 
 
 
+// Allowed s13 range at fixed s12, from the daughter energies in the (12) rest frame
+bool dalitzS13Range(double s12v, double &lo, double &hi){
+
+    if(s12v <= POW2(d1_MASS + d2_MASS) || s12v >= POW2(D_MASS - d3_MASS))
+        return false;
+
+    double m12 = sqrt(s12v);
+    double e1  = (s12v + POW2(d1_MASS) - POW2(d2_MASS)) / (2 * m12);
+    double e3  = (POW2(D_MASS) - s12v - POW2(d3_MASS)) / (2 * m12);
+    double p1  = sqrt(std::max(0.0, e1 * e1 - POW2(d1_MASS)));
+    double p3  = sqrt(std::max(0.0, e3 * e3 - POW2(d3_MASS)));
+
+    lo = POW2(e1 + e3) - POW2(p1 + p3);
+    hi = POW2(e1 + e3) - POW2(p1 - p3);
+    return true;
+}
+
+// Area of the rectangle [x0,x1]x[y0,y1] inside the Dalitz plot: the clipped s13 range
+// integrated over s12 with a composite 4-point Gauss-Legendre rule
+double dalitzOverlapArea(double x0, double x1, double y0, double y1){
+
+    static const double gx[4] = {-0.8611363115940526, -0.3399810435848563, 0.3399810435848563, 0.8611363115940526};
+    static const double gw[4] = {0.3478548451374538, 0.6521451548625461, 0.6521451548625461, 0.3478548451374538};
+    const int nSub = 4;
+
+    x0 = std::max(x0, (double)s12_min);
+    x1 = std::min(x1, (double)s12_max);
+    if(x1 <= x0 || y1 <= y0)
+        return 0;
+
+    double area = 0;
+    double h    = (x1 - x0) / nSub;
+    for(int k = 0; k < nSub; k++) {
+        double c = x0 + (k + 0.5) * h;
+        for(int g = 0; g < 4; g++) {
+            double lo, hi;
+            if(!dalitzS13Range(c + 0.5 * h * gx[g], lo, hi))
+                continue;
+            double len = std::min(y1, hi) - std::max(y0, lo);
+            if(len > 0)
+                area += 0.5 * h * gw[g] * len;
+        }
+    }
+    return area;
+}
+
+// Flat copy of a TH2 so the per-bin builder does not call into ROOT from worker threads
+struct TemplateSource {
+    std::vector<double> xedges;
+    std::vector<double> yedges;
+    std::vector<double> content; // x index runs fastest
+};
+
+TemplateSource makeTemplateSource(TH2F *hist){
+
+    TemplateSource src;
+    int nx = hist->GetNbinsX();
+    int ny = hist->GetNbinsY();
+
+    for(int i = 1; i <= nx + 1; i++)
+        src.xedges.push_back(hist->GetXaxis()->GetBinLowEdge(i));
+    for(int j = 1; j <= ny + 1; j++)
+        src.yedges.push_back(hist->GetYaxis()->GetBinLowEdge(j));
+
+    src.content.resize(nx * ny);
+    for(int j = 0; j < ny; j++)
+        for(int i = 0; i < nx; i++)
+            src.content[i + j * nx] = hist->GetBinContent(i + 1, j + 1);
+
+    return src;
+}
+
+// Source histogram integrated over [x0,x1]x[y0,y1] restricted to the Dalitz plot
+double sourceOverlapIntegral(const TemplateSource &src, double x0, double x1, double y0, double y1){
+
+    size_t nx = src.xedges.size() - 1;
+    size_t ny = src.yedges.size() - 1;
+
+    auto first = [](const std::vector<double> &edges, double v) -> size_t {
+        size_t i = std::upper_bound(edges.begin(), edges.end(), v) - edges.begin();
+        return i > 0 ? i - 1 : 0;
+    };
+
+    double sum = 0;
+    for(size_t iy = first(src.yedges, y0); iy < ny && src.yedges[iy] < y1; iy++) {
+        for(size_t ix = first(src.xedges, x0); ix < nx && src.xedges[ix] < x1; ix++) {
+            double c = src.content[ix + iy * nx];
+            if(c == 0)
+                continue;
+            sum += c * dalitzOverlapArea(std::max(x0, src.xedges[ix]),
+                                         std::min(x1, src.xedges[ix + 1]),
+                                         std::max(y0, src.yedges[iy]),
+                                         std::min(y1, src.yedges[iy + 1]));
+        }
+    }
+    return sum;
+}
+
+// Bin contents of a template on the current s12/s13 binning, in BinnedDataSet order.
+// Each bin gets the source histogram integrated over its overlap with the phase space,
+// which is the expectation of the old NevG accept-reject fill without the sampling noise.
+// With swap the old fill also added each point's (s13,s12) mirror, weighted by the histogram at
+// the mirror point; the phase space is symmetric, so that adds the same integral again. The
+// template is not symmetrised, so it is built over the whole plot even in symmetric mode.
+std::vector<fptype> buildTemplateWeights(TH2F *source, bool swap){
+
+    TemplateSource src = makeTemplateSource(source);
+
+    const size_t nx  = s12.getNumBins();
+    const size_t ny  = s13.getNumBins();
+    const double xlo = s12.getLowerLimit();
+    const double ylo = s13.getLowerLimit();
+    const double dx  = (s12.getUpperLimit() - xlo) / nx;
+    const double dy  = (s13.getUpperLimit() - ylo) / ny;
+
+    std::vector<fptype> weights(nx * ny);
+    double totalArea = 0;
+
+#pragma omp parallel for schedule(dynamic, 16) reduction(+ : totalArea)
+    for(long bin = 0; bin < (long)(nx * ny); bin++) {
+        double x0 = xlo + (bin % nx) * dx;
+        double y0 = ylo + (bin / nx) * dy;
+
+        double w = sourceOverlapIntegral(src, x0, x0 + dx, y0, y0 + dy);
+        if(swap)
+            w *= 2;
+
+        weights[bin] = w;
+        totalArea += dalitzOverlapArea(x0, x0 + dx, y0, y0 + dy);
+    }
+
+    // Same overall scale as NevG generated points
+    for(auto &w : weights)
+        w *= NevG / totalArea;
+
+    return weights;
+}
+
+// On-disk template cache. A file holds a fixed header followed by the bin contents in
+// BinnedDataSet order; the key hashes everything the contents depend on.
+struct TemplateCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t fpsize;
+    uint64_t key;
+    uint64_t nx;
+    uint64_t ny;
+};
+
+const char template_cache_magic[8] = {'D', '2', 'P', 'P', 'P', 'T', 'P', 'L'};
+
+uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL){
+
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t templateCacheKey(const TemplateSource &src, bool swap, fptype smoothing){
+
+    uint64_t key = fnv1a(src.xedges.data(), src.xedges.size() * sizeof(double));
+    key = fnv1a(src.yedges.data(), src.yedges.size() * sizeof(double), key);
+    key = fnv1a(src.content.data(), src.content.size() * sizeof(double), key);
+
+    double layout[] = {(double)s12.getNumBins(), (double)s13.getNumBins(),
+                       s12.getLowerLimit(), s12.getUpperLimit(), s13.getLowerLimit(), s13.getUpperLimit(),
+                       D_MASS, d1_MASS, d2_MASS, d3_MASS, NevG, (double)smoothing, swap ? 1.0 : 0.0};
+    return fnv1a(layout, sizeof(layout), key);
+}
+
+string templateCacheFile(uint64_t key){
+    return fmt::format("{}/template_{:016x}.bin", template_cache_dir, key);
+}
+
+// Maps a cache file and copies its bins into binned; false on a miss or a stale/foreign file
+bool loadTemplateCache(uint64_t key, BinnedDataSet *binned){
+
+    string fname = templateCacheFile(key);
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    size_t nbins = binned->getNumBins();
+    size_t size  = sizeof(TemplateCacheHeader) + nbins * sizeof(fptype);
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size != size) {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED)
+        return false;
+
+    const TemplateCacheHeader *header = static_cast<const TemplateCacheHeader *>(map);
+    bool good = memcmp(header->magic, template_cache_magic, sizeof(header->magic)) == 0 && header->version == 2
+                && header->fpsize == sizeof(fptype) && header->key == key && header->nx == s12.getNumBins()
+                && header->ny == s13.getNumBins();
+
+    if(good) {
+        const fptype *bins = reinterpret_cast<const fptype *>(header + 1);
+        for(size_t bin = 0; bin < nbins; bin++)
+            binned->setBinContent(bin, bins[bin]);
+    }
+
+    munmap(map, size);
+    return good;
+}
+
+// Written to a temporary name and renamed, so concurrent jobs never see a partial file
+void saveTemplateCache(uint64_t key, const std::vector<fptype> &weights){
+
+    ::mkdir(template_cache_dir.c_str(), 0755);
+
+    TemplateCacheHeader header;
+    memcpy(header.magic, template_cache_magic, sizeof(header.magic));
+    header.version = 2; // 1: swapped templates were symmetrised
+    header.fpsize  = sizeof(fptype);
+    header.key     = key;
+    header.nx      = s12.getNumBins();
+    header.ny      = s13.getNumBins();
+
+    string fname = templateCacheFile(key);
+    string tmp   = fmt::format("{}.{}", fname, getpid());
+
+    FILE *out = fopen(tmp.c_str(), "wb");
+    if(!out) {
+        GOOFIT_WARN("Cannot write template cache {}", tmp);
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+              && fwrite(weights.data(), sizeof(fptype), weights.size(), out) == weights.size();
+    ok = (fclose(out) == 0) && ok;
+
+    if(!ok || rename(tmp.c_str(), fname.c_str()) != 0) {
+        GOOFIT_WARN("Cannot write template cache {}", fname);
+        remove(tmp.c_str());
+    }
+}
+
+// Fills binned from the cache when possible, otherwise builds the template and stores it
+void fillTemplate(BinnedDataSet *binned, TH2F *source, bool swap, fptype smoothing){
+
+    FitTrace::Scope scope("templates");
+
+    uint64_t key = 0;
+    if(templateCacheOn) {
+        key = templateCacheKey(makeTemplateSource(source), swap, smoothing);
+        if(loadTemplateCache(key, binned)) {
+            cout << "Template loaded from cache: " << templateCacheFile(key) << endl;
+            return;
+        }
+    }
+
+    std::vector<fptype> weights = buildTemplateWeights(source, swap);
+    for(size_t bin = 0; bin < weights.size(); bin++)
+        binned->setBinContent(bin, weights[bin]);
+
+    if(templateCacheOn)
+        saveTemplateCache(key, weights);
+}
+
 SmoothHistogramPdf* makeEfficiencyPdf() {
 
     vector<Observable> lvars;
@@ -222,24 +1228,12 @@ SmoothHistogramPdf* makeEfficiencyPdf() {
     TH2F *bkgHistogram = (TH2F *)f->Get("h0");
     bkgHistogram->SetStats(false);
 
-    TRandom3 donram(0);
-    for(int i = 0; i < NevG; i++) {
-        do {
-            s12.setValue(donram.Uniform(s12.getLowerLimit(), s12.getUpperLimit()));
-            s13.setValue(donram.Uniform(s13.getLowerLimit(), s13.getUpperLimit()));
-        } while(!inDalitz(s12.getValue(), s13.getValue(), D_MASS, d1_MASS, d2_MASS, d3_MASS));
+    if(!weightHistogram)
+        weightHistogram = bkgHistogram;
 
-        double weight = weightHistogram->GetBinContent(weightHistogram->FindBin(s12.getValue(), s13.getValue()));
-        binEffData->addWeightedEvent(weight);
+    Variable effSmoothing("effSmoothing", 1);
+    fillTemplate(binEffData, weightHistogram, doEffSwap, effSmoothing.getValue());
 
-        if(doEffSwap) {
-            double swapmass = s12.getValue();
-            s12.setValue(s13.getValue());
-            s13.setValue(swapmass);
-            weight = weightHistogram->GetBinContent(weightHistogram->FindBin(s12.getValue(), s13.getValue()));
-            binEffData->addWeightedEvent(weight);
-        }
-    }
     if(saveEffPlot) {
         TCanvas foo;
         foo.cd();
@@ -249,7 +1243,6 @@ SmoothHistogramPdf* makeEfficiencyPdf() {
         foo.SaveAs("plots/efficiency_bins_log.png");
     }
     // Smooth
-    Variable effSmoothing("effSmoothing", 1);
     SmoothHistogramPdf *ret = new SmoothHistogramPdf("efficiency", binEffData, effSmoothing);
     return ret;
 }
@@ -291,26 +1284,8 @@ for(int i = 0; i < 100000 ; i++){
        cout << i << "\t" <<  s12.getValue() << '\t' << s13.getValue() << '\t' << binBkgData->getBinContent(i) << endl;
     } */
 
-    TRandom3 donram(50);
-    for(int i = 0; i < NevG; i++) {
-        do {
-            s12.setValue(donram.Uniform(s12.getLowerLimit(), s12.getUpperLimit()));
-            s13.setValue(donram.Uniform(s13.getLowerLimit(), s13.getUpperLimit()));
-        } while(!inDalitz(s12.getValue(), s13.getValue(), D_MASS, d1_MASS, d2_MASS, d3_MASS));
-
-        double weight = bkgHistogram->GetBinContent(bkgHistogram->FindBin(s12.getValue(), s13.getValue()));
-
-        binBkgData->addWeightedEvent(weight);
-
-        if(doEffSwap) {
-            double swapmass = s12.getValue();
-            s12.setValue(s13.getValue());
-            s13.setValue(swapmass);
-            weight = bkgHistogram->GetBinContent(bkgHistogram->FindBin(s12.getValue(), s13.getValue()));
-            binBkgData->addWeightedEvent(weight);
-           
-        }
-    }
+    Variable *effSmoothing = new Variable("effSmoothing", 1.0, 0.01, 0, 1);
+    fillTemplate(binBkgData, bkgHistogram, doEffSwap, effSmoothing->getValue());
 
     for(int i = 0; i < 10 ; i++){
        cout << i << "\t" <<  s12.getValue() << '\t' << s13.getValue() << '\t' << binBkgData->getBinContent(i) << endl;
@@ -328,7 +1303,6 @@ for(int i = 0; i < 100000 ; i++){
 
     
 
-    Variable *effSmoothing  = new Variable("effSmoothing", 1.0, 0.01, 0, 1);
     SmoothHistogramPdf *ret = new SmoothHistogramPdf("efficiency", binBkgData, *effSmoothing);
 
     s12.setNumBins(1500);
@@ -339,7 +1313,9 @@ for(int i = 0; i < 100000 ; i++){
 
 
 
-DalitzPlotPdf* makesignalpdf(GooPdf* eff){
+// The S-wave spline is always in; isobars adds the named resonances below (omega, f2, sigma,
+// f0_1500, f0_980, nonr) with floating couplings
+DalitzPlotPdf* makesignalpdf(GooPdf* eff, const std::vector<std::string> &isobars){
 
     DecayInfo3 dtoppp;
     dtoppp.motherMass   = D_MASS;
@@ -415,7 +1391,7 @@ DalitzPlotPdf* makesignalpdf(GooPdf* eff){
     Variable v_f0_980_amp_img("f0_980_amp_img",f0_980_amp*sin(f0_980_phase), 0.001, -100.0, +100.0);
 
     //f0(1500)
-    Variable v_f0_1500_Mass("f0_1500_MASS",f0_1500_MASS,0.01,1350.0,1510.0);
+    Variable v_f0_1500_Mass("f0_1500_MASS",f0_1500_MASS,0.01,1.350,1.510);
     Variable v_f0_1500_Width("f0_1500_Width",f0_1500_WIDTH,0.01,0.1,0.2);
     Variable v_f0_1500_amp_real("f0_amp_1500_real",f0_1500_amp*cos(f0_1500_phase), 0.001, -100.0, +100.0);
     Variable v_f0_1500_amp_img("f0_1500_amp_img",f0_1500_amp*sin(f0_1500_phase), 0.001, -100.0, +100.0);
@@ -451,6 +1427,19 @@ DalitzPlotPdf* makesignalpdf(GooPdf* eff){
     //dtoppp.resonances.push_back(nonr);
     dtoppp.resonances.push_back(swave_12);
 
+    std::map<std::string, ResonancePdf *> available = {{"omega", omega_12},
+                                                       {"f2", f2_12},
+                                                       {"sigma", sigma_12},
+                                                       {"f0_1500", f0_1500_12},
+                                                       {"f0_980", f0_980_12},
+                                                       {"nonr", nonr}};
+    for(const std::string &name : isobars) {
+        auto res = available.find(name);
+        if(res == available.end())
+            throw GooFit::GeneralError("Unknown isobar resonance {}", name);
+        dtoppp.resonances.push_back(res->second);
+    }
+
     if(!eff) {
         // By default create a constant efficiency.
         vector<Variable> offsets;
@@ -474,56 +1463,137 @@ DalitzPlotPdf* makesignalpdf(GooPdf* eff){
 
 
 
-void getdata(std::string name){
+// Where getdata() reads from, resolved on the main thread: the Observable names, the MPI
+// share and ROOT's implicit MT stay out of readDataColumns()
+struct DataSource {
+    bool toy = false;
+    std::string name;               // toy file, or the data tree's file
+    std::vector<std::string> names; // toy event-file columns, or tree branches (weights last)
+    TreeSelection sel;              // part/parts: this process's MPI rank and the process count
+};
+
+// The columns read and the events they are: [first, first + N) of total
+struct DataColumns {
+    std::vector<std::vector<double>> columns; // s12, s13 (and the weights under --weight)
+    size_t first = 0, total = 0;
+};
+
+DataSource dataSource(const std::string &name){
+
+    if(toyOn && !weight_branch.empty())
+        throw GooFit::GeneralError("--weight reads a branch of the data tree, the toy file has none");
+
+    DataSource src;
+    src.toy       = toyOn;
+    src.sel       = data_selection;
+    src.sel.part  = mpiRank();
+    src.sel.parts = mpiSize();
+    if(toyOn) {
+        src.name  = name;
+        src.names = {s12.getName(), s13.getName()};
+    } else {
+        src.name  = data_name;
+        src.names = {"s12_pipi_DTF", "s13_pipi_DTF"};
+        if(!weight_branch.empty())
+            src.names.push_back(weight_branch);
+        if(src.sel.threads != 1)
+            ROOT::EnableImplicitMT(src.sel.threads);
+    }
+    return src;
+}
 
-    std::cout << "get data begin!" << '\n';
+// Reads the toy, or this process's share of the data tree entries. Touches no GooFit, MPI or
+// global state, so runtoyfit() runs it beside the PDF construction.
+DataColumns readDataColumns(const DataSource &src){
 
-    Data = new UnbinnedDataSet({s12,s13,eventNumber});
+    FitTrace::Scope scope("read data");
+    std::cout << "get data begin!" << '\n';
 
-if(toyOn){
-    std::ifstream reader(name.c_str());
+    DataColumns read;
+    if(src.toy)
+        read.columns = readToyColumns(src.name, src.names);
+    else {
+        cout << "Opening: " << src.name << " for reading." << endl;
+        read.columns = readTreeColumns(src.name, tree_name, src.names, src.sel);
+    }
+    read.total = read.columns[0].size();
+    return read;
+}
 
-    while(reader >> eventNumber >> s12 >> s13){
+// Under MPI (main thread): leaves each process its ownedEvents() share. Every process read
+// the whole toy, while the tree rows are moved between processes.
+void distributeData(DataColumns &read, const DataSource &src){
 
-        	Data->addEvent();
+    if(src.sel.parts == 1)
+        return;
 
+    if(src.toy) {
+        size_t last;
+        ownedEvents(read.total, src.sel.part, src.sel.parts, read.first, last);
+        for(auto &column : read.columns)
+            column = std::vector<double>(column.begin() + read.first, column.begin() + last);
     }
+#ifdef D2PPP_MPI
+    else
+        redistributeRows(read.columns, src.sel.maxEvents, read.first, read.total);
+#endif
+}
 
-    reader.close();
-
-}else{
+// Builds Data (and event_weights) from the columns read
+void fillData(DataColumns read){
 
-    cout << "Opening: " << data_name << " for reading." << endl;
-    TFile *f = TFile::Open(data_name.c_str());
-    TTree *t = (TTree *)f->Get("sTree");
+    FitTrace::Scope scope("fill data");
 
-    double _s12, _s13;
+    data_first_event  = read.first;
+    data_total_events = read.total;
 
-    t->SetBranchAddress("s12_pipi_DTF",&_s12);
-    t->SetBranchAddress("s13_pipi_DTF",&_s13);
-   
+    std::vector<std::vector<double>> &columns = read.columns;
+    event_weights.clear();
+    if(columns.size() > 2)
+        event_weights = std::move(columns[2]);
 
-    for(size_t i = 0; i < 100000 ; i++){
+    // eventNumber indexes the PDF caches, so it must count 0..N-1 whatever entries were selected
+    size_t n = columns[0].size();
+    std::vector<double> index(n);
+    for(size_t i = 0; i < n; i++)
+        index[i] = i;
 
-       
+    delete Data;
+    Data = new UnbinnedDataSet({s12,s13,eventNumber});
+    fillDataSet(Data, {s12, s13, eventNumber}, {columns[0].data(), columns[1].data(), index.data()}, n);
 
-            t->GetEntry(i);
-            s12.setValue(_s12);
-            s13.setValue(_s13);
-            eventNumber.setValue(i);
-            Data->addEvent();
+    FitTrace::instance().memory("dataset", Data->getNumEvents() * 3 * sizeof(fptype));
+    std::cout << "get data end!" << '\n';
+}
 
-    }
+void getdata(std::string name){
 
+    DataSource src   = dataSource(name);
+    DataColumns read = readDataColumns(src);
+    distributeData(read, src);
+    fillData(std::move(read));
+}
 
-    f->Close();
+// Startup of the GooFit fits (single process): the data is read on a worker thread while the
+// caller builds the templates and the PDFs, which stay on this thread (GooFit registers PDFs
+// and Observables in global tables); collect it with fillData(). ROOT goes thread-safe as the
+// templates open the data file too.
+std::future<DataColumns> startData(const std::string &name){
 
+    DataSource src = dataSource(name);
+    ROOT::EnableThreadSafety();
+    return std::async(std::launch::async, readDataColumns, std::move(src));
 }
-    
-    std::cout << "get data end!" << '\n';
+
+std::vector<double> dataColumn(const Observable &obs){
+
+    std::vector<double> column(Data->getNumEvents());
+    for(size_t i = 0; i < column.size(); i++)
+        column[i] = Data->getValue(obs, i);
+    return column;
 }
 
-void runtoygen(std::string name, size_t events){
+void runtoygen(std::string name, size_t events, std::string textname, uint32_t seed){
 
     s12.setNumBins(1500);
     s13.setNumBins(1500);
@@ -548,11 +1618,11 @@ void runtoygen(std::string name, size_t events){
     
     
     {
-        maketoydalitzdata(overallPdf,name,events);
+        maketoydalitzdata(overallPdf,name,events,textname,seed);
     }
 }
 
-void PrintFF(std::vector<std::vector<fptype>> ff){
+void PrintFF(std::vector<std::vector<fptype>> ff, const std::vector<std::vector<fptype>> &fferr = {}){
 
     size_t nEntries = signaldalitz->getCachedWave(0).size();
     size_t n_res = signaldalitz->getDecayInfo().resonances.size();
@@ -562,7 +1632,10 @@ void PrintFF(std::vector<std::vector<fptype>> ff){
     for(size_t i = 0; i < n_res ; i++){
 
         for(size_t j = 0; j< n_res ; j++){
-            std::cout << "FF[" << i << "," << j <<"]= " << ff[i][j] << std::endl;
+            std::cout << "FF[" << i << "," << j <<"]= " << ff[i][j];
+            if(!fferr.empty())
+                std::cout << " +- " << fferr[i][j];
+            std::cout << std::endl;
 
         }
 
@@ -572,6 +1645,120 @@ void PrintFF(std::vector<std::vector<fptype>> ff){
     std::cout << "Sum[i,i]= " << sum << std::endl;
 }
 
+// Fit fractions from the interference matrix I[i][j] = sum_e w_i(e) conj(w_j(e)) of the
+// cached waves. DalitzPlotPdf::fit_fractions() runs the same event sums for every (i,j) on
+// every call; with I kept, FF[i][j] = Re(c_i conj(c_j) I[i][j]) / sum_kl Re(c_k conj(c_l) I[k][l])
+// is an n_res^2 sum for any couplings c, and its derivatives are closed-form, so the
+// covariance of the couplings is propagated linearly. The wave shapes are held at the values
+// the cache was filled with.
+class FitFractions {
+  public:
+    explicit FitFractions(DalitzPlotPdf *pdf) {
+        const auto &res = pdf->getDecayInfo().resonances;
+        n_ = res.size();
+
+        std::vector<std::vector<std::complex<fptype>>> waves(n_);
+        for(size_t i = 0; i < n_; i++) {
+            waves[i] = pdf->getCachedWave(i);
+            real_.push_back(res[i]->get_amp_real());
+            imag_.push_back(res[i]->get_amp_img());
+        }
+
+        inter_.assign(n_ * n_, 0);
+#pragma omp parallel for schedule(dynamic)
+        for(long ij = 0; ij < (long)(n_ * n_); ij++) {
+            size_t i = ij / n_, j = ij % n_;
+            if(j < i)
+                continue;
+            std::complex<fptype> sum = 0;
+            for(size_t e = 0; e < waves[i].size(); e++)
+                sum += waves[i][e] * std::conj(waves[j][e]);
+            inter_[i * n_ + j] = sum;
+            inter_[j * n_ + i] = std::conj(sum);
+        }
+    }
+
+    size_t size() const { return n_; }
+
+    // FF[i][j] at the current coupling values
+    std::vector<std::vector<fptype>> fractions() const {
+        std::vector<std::vector<fptype>> ff(n_, std::vector<fptype>(n_));
+        fptype total = 0;
+        for(size_t i = 0; i < n_; i++)
+            for(size_t j = 0; j < n_; j++) {
+                ff[i][j] = std::real(coupling(i) * std::conj(coupling(j)) * inter_[i * n_ + j]);
+                total += ff[i][j];
+            }
+        for(auto &row : ff)
+            for(fptype &v : row)
+                v /= total;
+        return ff;
+    }
+
+    // Errors on FF[i][j] from the covariance of the fit. Couplings that are fixed, or not in
+    // the fit, do not contribute.
+    std::vector<std::vector<fptype>> errors(const ROOT::Minuit2::MnUserParameterState &state) const {
+        std::vector<std::vector<fptype>> err(n_, std::vector<fptype>(n_, 0));
+        if(!state.HasCovariance())
+            return err;
+
+        // Internal (free) parameter index of Re c_k and Im c_k, -1 if not free
+        std::vector<int> index(2 * n_, -1);
+        const auto &pars = state.MinuitParameters();
+        for(size_t k = 0; k < 2 * n_; k++) {
+            const Variable &v = k % 2 ? imag_[k / 2] : real_[k / 2];
+            for(const auto &p : pars)
+                if(v.getName() == p.Name() && !p.IsFixed() && !p.IsConst())
+                    index[k] = state.IntOfExt(p.Number());
+        }
+
+        // d total / d(Re c_k, Im c_k): 2 Re/-2 Im of sum_j conj(c_j) I[k][j]
+        fptype total = 0;
+        std::vector<fptype> dtotal(2 * n_);
+        for(size_t k = 0; k < n_; k++) {
+            std::complex<fptype> sum = 0;
+            for(size_t j = 0; j < n_; j++) {
+                sum += std::conj(coupling(j)) * inter_[k * n_ + j];
+                total += std::real(coupling(k) * std::conj(coupling(j)) * inter_[k * n_ + j]);
+            }
+            dtotal[2 * k]     = 2 * std::real(sum);
+            dtotal[2 * k + 1] = -2 * std::imag(sum);
+        }
+
+        const std::complex<fptype> I(0, 1);
+        const auto &cov = state.Covariance();
+        std::vector<fptype> jac(2 * n_);
+        for(size_t i = 0; i < n_; i++)
+            for(size_t j = 0; j < n_; j++) {
+                const std::complex<fptype> w = inter_[i * n_ + j];
+                fptype ff = std::real(coupling(i) * std::conj(coupling(j)) * w) / total;
+
+                for(size_t k = 0; k < 2 * n_; k++)
+                    jac[k] = -ff * dtotal[k];
+                jac[2 * i] += std::real(std::conj(coupling(j)) * w);
+                jac[2 * i + 1] += std::real(I * std::conj(coupling(j)) * w);
+                jac[2 * j] += std::real(coupling(i) * w);
+                jac[2 * j + 1] += std::real(-I * coupling(i) * w);
+
+                fptype var = 0;
+                for(size_t a = 0; a < 2 * n_; a++)
+                    for(size_t b = 0; b < 2 * n_; b++)
+                        if(index[a] >= 0 && index[b] >= 0)
+                            var += jac[a] * cov(index[a], index[b]) * jac[b];
+                err[i][j] = std::sqrt(std::max<fptype>(var, 0)) / total;
+            }
+        return err;
+    }
+
+  private:
+    std::complex<fptype> coupling(size_t k) const { return {real_[k].getValue(), imag_[k].getValue()}; }
+
+    size_t n_;
+    std::vector<std::complex<fptype>> inter_;
+    std::vector<Variable> real_;
+    std::vector<Variable> imag_;
+};
+
 
 void drawFitPlotsWithPulls(TH1 *hd, TH1 *ht, string plotdir) {
     const char *hname = hd->GetName();
@@ -624,7 +1811,6 @@ void makeToyDalitzPdfPlots(GooPdf *overallSignal, string plotdir = "plots") {
 
     TH1F s23_pdf_hist("s23_pdf_hist", "", s13.getNumBins(), s13.getLowerLimit(), s13.getUpperLimit());
 
-    double totalPdf = 0;
     double totalDat = 0;
     TH2F dalitzpp0_dat_hist("dalitzpp0_dat_hist",
                             "",
@@ -649,37 +1835,18 @@ void makeToyDalitzPdfPlots(GooPdf *overallSignal, string plotdir = "plots") {
     dalitzpp0_pdf_hist.GetXaxis()->SetTitle("m^{2}(K^{-} K^{+}) [GeV^{2}]");
     dalitzpp0_pdf_hist.GetYaxis()->SetTitle("m^{2}(K^{-} K^{+}) [GeV^{2}]");
     dalitzpp0_pdf_hist.SetStats(false);
-    std::vector<Observable> vars;
-    vars.push_back(s12);
-    vars.push_back(s13);
-    vars.push_back(eventNumber);
-    UnbinnedDataSet currData(vars);
-    int evtCounter = 0;
-
-    for(int i = 0; i < s12.getNumBins(); ++i) {
-        s12.setValue(s12.getLowerLimit() + (s12.getUpperLimit() - s12.getLowerLimit()) * (i + 0.5) / s12.getNumBins());
-        for(int j = 0; j < s13.getNumBins(); ++j) {
-            s13.setValue(s13.getLowerLimit()
-                         + (s13.getUpperLimit() - s13.getLowerLimit()) * (j + 0.5) / s13.getNumBins());
-            if(!inDalitz(s12.getValue(), s13.getValue(), D_MASS, d1_MASS, d2_MASS, d3_MASS)){
-                continue;}
-            eventNumber.setValue(evtCounter);
-            evtCounter++;
-            currData.addEvent();
-        }
-    }
-    overallSignal->setData(&currData);
-    signaldalitz->setDataSize(currData.getNumEvents());
-    std::vector<std::vector<double>> pdfValues = overallSignal->getCompProbsAtDataPoints();
-    for(unsigned int j = 0; j < pdfValues[0].size(); ++j) {
-        double currs12 = currData.getValue(s12, j);
-        double currs13 = currData.getValue(s13, j);
-
-        dalitzpp0_pdf_hist.Fill(currs12, currs13, pdfValues[0][j]);
-        s12_pdf_hist.Fill(currs12, pdfValues[0][j]);
-        s13_pdf_hist.Fill(currs13, pdfValues[0][j]);
-        s23_pdf_hist.Fill(cpuGetM23(currs12, currs13), pdfValues[0][j]);
-        totalPdf += pdfValues[0][j];
+    DalitzProjections proj = [&]() {
+        FitTrace::Scope scope("projections");
+        return projectPdf(overallSignal);
+    }();
+    for(size_t i = 0; i < proj.nx; ++i) {
+        s12_pdf_hist.SetBinContent(i + 1, proj.s12[i]);
+        for(size_t j = 0; j < proj.ny; ++j)
+            dalitzpp0_pdf_hist.SetBinContent(i + 1, j + 1, proj.dalitz[i * proj.ny + j]);
+    }
+    for(size_t j = 0; j < proj.ny; ++j) {
+        s13_pdf_hist.SetBinContent(j + 1, proj.s13[j]);
+        s23_pdf_hist.SetBinContent(j + 1, proj.s23[j]);
     }
 
     TCanvas foo;
@@ -710,13 +1877,15 @@ void runMakeToyDalitzPdfPlots(std::string name){
     s12.setNumBins(1500);
     s13.setNumBins(1500);
 
-    getdata(name);
+    auto data = startData(name);
 
     signaldalitz = makesignalpdf(0);
     bkgdalitz = makeBackgroundPdf();
 
     bkgdalitz->setParameterConstantness(true);
 
+    fillData(data.get());
+
     Variable constant("constant",1);
     std::vector<Variable> weights;
     weights.push_back(constant);
@@ -770,17 +1939,284 @@ void saveParameters(const std::vector<ROOT::Minuit2::MinuitParameter> &param, st
 
 
 
-void runtoyfit(std::string name) {
+// Binary fit checkpoint: the Minuit2 user state after a stretch of Migrad calls, i.e. the
+// parameters with errors and limits and the covariance of the free parameters (packed lower
+// triangle, in internal parameter order)
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t done; // Migrad finished
+    uint64_t nPars;
+    uint64_t nFree; // 0 without a covariance
+    uint64_t nFcn;
+    double fval;
+    double edm;
+};
+
+struct CheckpointParameter {
+    char name[64];
+    double value, error, lower, upper;
+    uint32_t fixed, limited;
+};
+
+const char checkpoint_magic[8] = {'D', '2', 'P', 'P', 'P', 'C', 'K', 'P'};
+
+struct Checkpoint {
+    CheckpointHeader header;
+    std::vector<CheckpointParameter> pars;
+    std::vector<double> cov;
+};
+
+void writeCheckpoint(const std::string &fname, const ROOT::Minuit2::MnUserParameterState &state, unsigned int nFcn, bool done){
+
+    const auto &pars = state.MinuitParameters();
+
+    CheckpointHeader header;
+    memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = 1;
+    header.done    = done;
+    header.nPars   = pars.size();
+    header.nFree   = state.HasCovariance() ? state.VariableParameters() : 0;
+    header.nFcn    = nFcn;
+    header.fval    = state.Fval();
+    header.edm     = state.Edm();
+
+    std::vector<CheckpointParameter> out(pars.size());
+    for(size_t i = 0; i < pars.size(); i++) {
+        memset(&out[i], 0, sizeof(CheckpointParameter));
+        strncpy(out[i].name, pars[i].Name(), sizeof(out[i].name) - 1);
+        out[i].value   = pars[i].Value();
+        out[i].error   = pars[i].Error();
+        out[i].fixed   = pars[i].IsFixed() || pars[i].IsConst();
+        out[i].limited = pars[i].HasLimits();
+        out[i].lower   = pars[i].HasLimits() ? pars[i].LowerLimit() : 0;
+        out[i].upper   = pars[i].HasLimits() ? pars[i].UpperLimit() : 0;
+    }
+
+    std::vector<double> cov;
+    for(unsigned int i = 0; i < header.nFree; i++)
+        for(unsigned int j = 0; j <= i; j++)
+            cov.push_back(state.Covariance()(i, j));
+
+    // Written next to the target and renamed, so a crash never leaves a torn checkpoint
+    string tmp = fmt::format("{}.{}", fname, getpid());
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if(!file) {
+        GOOFIT_WARN("Cannot write checkpoint {}", tmp);
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+              && fwrite(out.data(), sizeof(CheckpointParameter), out.size(), file) == out.size()
+              && fwrite(cov.data(), sizeof(double), cov.size(), file) == cov.size();
+    ok = (fclose(file) == 0) && ok;
+
+    if(!ok || rename(tmp.c_str(), fname.c_str()) != 0) {
+        GOOFIT_WARN("Cannot write checkpoint {}", fname);
+        remove(tmp.c_str());
+    }
+}
+
+bool readCheckpoint(const std::string &fname, Checkpoint &ckp){
+
+    FILE *file = fopen(fname.c_str(), "rb");
+    if(!file)
+        return false;
+
+    bool ok = fread(&ckp.header, sizeof(ckp.header), 1, file) == 1
+              && memcmp(ckp.header.magic, checkpoint_magic, sizeof(checkpoint_magic)) == 0
+              && ckp.header.version == 1;
+    if(ok) {
+        ckp.pars.resize(ckp.header.nPars);
+        ckp.cov.resize(ckp.header.nFree * (ckp.header.nFree + 1) / 2);
+        ok = fread(ckp.pars.data(), sizeof(CheckpointParameter), ckp.pars.size(), file) == ckp.pars.size()
+             && fread(ckp.cov.data(), sizeof(double), ckp.cov.size(), file) == ckp.cov.size();
+    }
+    fclose(file);
+
+    if(!ok)
+        throw GooFit::GeneralError("{} is not a valid fit checkpoint", fname);
+    return true;
+}
+
+// Starting state of a fit: upar as set up, or with --resume/--warm-start the values and errors
+// of a checkpoint, matched by name. The covariance is reused when the free parameters are the
+// same, in the same order, so Migrad starts from the previous error matrix.
+ROOT::Minuit2::MnUserParameterState fitStartState(const ROOT::Minuit2::MnUserParameters &upar){
+
+    std::string from = fit_checkpointing.warmStart;
+    if(from.empty() && fit_checkpointing.resume)
+        from = fit_checkpointing.file;
+    if(from.empty())
+        return ROOT::Minuit2::MnUserParameterState(upar);
+
+    Checkpoint ckp;
+    if(!readCheckpoint(from, ckp)) {
+        if(!fit_checkpointing.warmStart.empty())
+            throw GooFit::GeneralError("Cannot open checkpoint {}", from);
+        GOOFIT_INFO("No checkpoint {} yet, starting from the seeds", from);
+        return ROOT::Minuit2::MnUserParameterState(upar);
+    }
+
+    ROOT::Minuit2::MnUserParameters start = upar;
+    std::vector<std::string> freeNow, freeThen;
+    for(const auto &p : upar.Parameters())
+        if(!p.IsFixed() && !p.IsConst())
+            freeNow.push_back(p.Name());
+    for(const auto &p : ckp.pars)
+        if(!p.fixed)
+            freeThen.push_back(p.name);
+
+    size_t matched = 0;
+    for(const auto &p : ckp.pars) {
+        for(const auto &q : upar.Parameters()) {
+            if(p.name != std::string(q.Name()) || q.IsFixed() || q.IsConst())
+                continue;
+            start.SetValue(q.Number(), p.value);
+            if(p.error > 0)
+                start.SetError(q.Number(), p.error);
+            matched++;
+        }
+    }
+
+    GOOFIT_INFO("Starting from {} (FCN = {}, {} calls{}): {} of {} free parameters matched",
+                from, ckp.header.fval, ckp.header.nFcn, ckp.header.done ? ", converged" : "", matched, freeNow.size());
+
+    if(ckp.header.nFree == 0 || freeNow != freeThen)
+        return ROOT::Minuit2::MnUserParameterState(start);
+
+    const unsigned int n = ckp.header.nFree;
+    ROOT::Minuit2::MnUserCovariance cov(n);
+    size_t k = 0;
+    for(unsigned int i = 0; i < n; i++)
+        for(unsigned int j = 0; j <= i; j++)
+            cov(i, j) = ckp.cov[k++];
+    return ROOT::Minuit2::MnUserParameterState(start, cov);
+}
+
+// Migrad in stretches of fit_checkpointing.calls FCN calls, checkpointing the state after
+// each; the next stretch starts from that state, covariance included. The total is capped at
+// the Migrad default of 200 + 100 n + 5 n^2 calls.
+template <typename FCN>
+ROOT::Minuit2::FunctionMinimum migradWithCheckpoints(const FCN &fcn, ROOT::Minuit2::MnUserParameterState state){
+
+    FitTrace::Scope scope("fit");
+
+    const unsigned int nFree    = state.VariableParameters();
+    const unsigned int maxCalls = 200 + 100 * nFree + 5 * nFree * nFree;
+    unsigned int calls          = 0;
+
+    for(;;) {
+        unsigned int stretch = !fit_checkpointing.file.empty() && fit_checkpointing.calls > 0
+                                   ? std::min(fit_checkpointing.calls, maxCalls - calls)
+                                   : maxCalls;
+
+        ROOT::Minuit2::MnMigrad migrad(fcn, state);
+        auto func_min = migrad(stretch);
+        calls += func_min.NFcn();
+
+        bool done = !func_min.HasReachedCallLimit() || calls >= maxCalls;
+        if(!fit_checkpointing.file.empty())
+            writeCheckpoint(fit_checkpointing.file, func_min.UserState(), calls, done);
+        if(done)
+            return func_min;
+
+        GOOFIT_INFO("Checkpoint after {} calls: FCN = {}, EDM = {}", calls, func_min.Fval(), func_min.Edm());
+        state = func_min.UserState();
+    }
+}
+
+// GooFit's FCN with every NLL call timed. GooFit updates the parameters, recomputes the
+// cached waves and integrals and reduces over the events inside one calculateNLL(), so from
+// outside a call is one phase; the host MIPWA likelihood (--quadNorm) splits its calls into
+// coefficient mapping, event loop, normalisation and gradient.
+//
+// DalitzPlotPdf keeps one cached wave per resonance and recomputes a wave, and the integrals
+// it enters, only when a parameter of that resonance's lineshape changed; the couplings
+// belong to DalitzPlotPdf itself and only re-weight the cached waves. With the dalitz PDF
+// given, the FCN maps each Minuit parameter to the resonances it feeds and counts, per call,
+// the waves that rule predicts GooFit recomputes ("predicted wave recomputes/<name>") and
+// the calls it predicts only move couplings ("predicted coupling-only calls"). These are
+// predictions from the Minuit-side parameter changes, not measurements of GooFit's work.
+class TracedFCN : public GooFit::FCN {
+  public:
+    TracedFCN(GooFit::Params &params, DalitzPlotPdf *dalitz = nullptr)
+        : GooFit::FCN(params) {
+        if(!dalitz)
+            return;
+
+        std::map<std::string, unsigned int> index;
+        for(const ROOT::Minuit2::MinuitParameter &p : params.Parameters())
+            index[p.Name()] = p.Number();
+
+        feeds_.resize(params.Parameters().size());
+        for(ResonancePdf *res : dalitz->getDecayInfo().resonances) {
+            predictedCounter_.push_back("predicted wave recomputes/" + res->getName());
+            for(const Variable &v : res->getParameters()) {
+                auto it = index.find(v.getName());
+                if(it != index.end())
+                    feeds_[it->second].push_back(predictedCounter_.size() - 1);
+            }
+        }
+    }
+
+    double operator()(const std::vector<double> &pars) const override {
+        FitTrace::Scope scope("nll");
+        if(FitTrace::instance().enabled() && !predictedCounter_.empty())
+            predictRecomputes(pars);
+        return GooFit::FCN::operator()(pars);
+    }
+
+  private:
+    void predictRecomputes(const std::vector<double> &pars) const {
+        std::vector<bool> dirty(predictedCounter_.size(), last_.empty());
+        for(size_t k = 0; k < pars.size() && !last_.empty(); k++)
+            if(pars[k] != last_[k])
+                for(size_t r : feeds_[k])
+                    dirty[r] = true;
+        last_ = pars;
+
+        bool any = false;
+        for(size_t r = 0; r < dirty.size(); r++)
+            if(dirty[r]) {
+                FitTrace::instance().count(predictedCounter_[r]);
+                any = true;
+            }
+        if(!any)
+            FitTrace::instance().count("predicted coupling-only calls");
+    }
+
+    std::vector<std::vector<size_t>> feeds_; // resonances fed by each Minuit parameter
+    std::vector<std::string> predictedCounter_;
+    mutable std::vector<double> last_;
+};
+
+// FitManagerMinuit2::fit() with checkpoints, warm start and the traced FCN
+ROOT::Minuit2::FunctionMinimum fitWithCheckpoints(FitManagerMinuit2 &fitter, int verbosity = 0){
+
+    // Minuit2's printout at `verbosity`, as FitManagerMinuit2::fit() sets it
+    int level = ROOT::Minuit2::MnPrint::Level();
+    ROOT::Minuit2::MnPrint::SetLevel(verbosity);
+
+    GooFit::Params *upar = fitter.getParams();
+    TracedFCN fcn(*upar, signaldalitz);
+    auto func_min = migradWithCheckpoints(fcn, fitStartState(*upar));
+    upar->SetGooFitParams(func_min.UserState());
+
+    if(verbosity > 0)
+        std::cout << func_min << std::endl;
+    ROOT::Minuit2::MnPrint::SetLevel(level);
+    return func_min;
+}
+
+void runtoyfit(std::string name, const std::vector<std::string> &isobars) {
 
     s12.setNumBins(1500);
     s13.setNumBins(1500);
 
-    getdata(name);
+    auto data = startData(name);
+
+    signaldalitz = makesignalpdf(0, isobars);
 
-    GOOFIT_INFO("Number of Events in dataset: {}", Data->getNumEvents());
- 
-    signaldalitz = makesignalpdf(0);
-    
 
     Variable constant("constant",1);
     std::vector<Variable> weights;
@@ -795,13 +2231,16 @@ void runtoyfit(std::string name) {
         comps.push_back(bkgdalitz);
     }
 
+    fillData(data.get());
+    GOOFIT_INFO("Number of Events in dataset: {}", Data->getNumEvents());
+
     AddPdf* overallPdf = new AddPdf("overallPdf",weights,comps);
     overallPdf->setData(Data);
     // overallPdf->addSpecialMask(PdfBase::ForceSeparateNorm);
     signaldalitz->setDataSize(Data->getNumEvents());
+    traceCachedWaves(Data->getNumEvents());
 
     FitManagerMinuit2 fitter(overallPdf);
-    fitter.setVerbosity(3);
 
 
     auto param = fitter.getParams()->Parameters();
@@ -809,14 +2248,21 @@ void runtoyfit(std::string name) {
     saveParameters(param, "Parametros_iniciais.txt");
 
 
-    auto func_min = fitter.fit();
+    auto func_min = fitWithCheckpoints(fitter, 3);
 
 
-    auto ff = signaldalitz->fit_fractions();
+    std::vector<std::vector<fptype>> ff, fferr;
+    {
+        CLI::AutoTimer timer("Fit fractions");
+        FitTrace::Scope scope("fit fractions");
+        FitFractions fractions(signaldalitz);
+        ff    = fractions.fractions();
+        fferr = fractions.errors(func_min.UserState());
+    }
 
     auto param2 = fitter.getParams()->Parameters();
 
-    PrintFF(ff);
+    PrintFF(ff, fferr);
 
     makeToyDalitzPdfPlots(overallPdf);
 
@@ -827,43 +2273,866 @@ void runtoyfit(std::string name) {
 
 
 
-int main(int argc, char **argv){
+// Generates and fits nToys toys in one process. The PDF graph, its normalisation caches,
+// the templates and the generator envelope are built once and reused; each toy only swaps
+// the dataset, and toy k is stream k of the generator seed. GooFit keeps a single set of device-side PDF tables, so toys are
+// fitted one after another and the cores are used inside each likelihood evaluation.
+void runtoystudy(size_t nToys, size_t events, std::string outname, uint32_t seed){
+
+    s12.setNumBins(1500);
+    s13.setNumBins(1500);
+
+    signaldalitz = makesignalpdf(0);
+
+    Variable constant("constant",1);
+    std::vector<Variable> weights;
+    weights.push_back(constant);
+
+    comps.clear();
+    comps.push_back(signaldalitz);
+
+    if(bkgOn){
+        bkgdalitz = makeBackgroundPdf();
+        bkgdalitz->setParameterConstantness(true);
+        comps.push_back(bkgdalitz);
+        weights.push_back(constant);
+    }
+
+    AddPdf* overallPdf = new AddPdf("overallPdf",weights,comps);
+
+    std::vector<Variable> floated;
+    for(Variable &v : overallPdf->getParameters())
+        if(!v.IsFixed())
+            floated.push_back(v);
+
+    std::vector<fptype> truth, steps;
+    for(Variable &v : floated) {
+        truth.push_back(v.getValue());
+        steps.push_back(v.getError());
+    }
+
+    ToyGenerator generator(overallPdf);
+
+    std::ofstream out(outname.c_str());
+    out << "toy\tvalid\tnll\tedm";
+    for(Variable &v : floated)
+        out << "\t" << v.getName() << "_val\t" << v.getName() << "_err\t" << v.getName() << "_pull";
+    out << '\n';
+
+    UnbinnedDataSet *toyData = nullptr;
+
+    for(size_t toy = 0; toy < nToys; toy++) {
+
+        for(size_t k = 0; k < floated.size(); k++) {
+            floated[k].setValue(truth[k]);
+            floated[k].setError(steps[k]);
+        }
+
+        // The generator evaluates the PDF at the truth values
+        std::vector<double> x, y, evts(events);
+        generator.generate(events, seed, toy, x, y);
+        for(size_t i = 0; i < events; i++)
+            evts[i] = i;
+
+        UnbinnedDataSet *next = new UnbinnedDataSet({s12, s13, eventNumber});
+        fillDataSet(next, {s12, s13, eventNumber}, {x.data(), y.data(), evts.data()}, events);
+
+        overallPdf->setData(next);
+        signaldalitz->setDataSize(next->getNumEvents());
+        traceCachedWaves(next->getNumEvents());
+        delete toyData;
+        toyData = next;
+
+        FitManagerMinuit2 fitter(overallPdf);
+        fitter.setVerbosity(0);
+        auto func_min = fitter.fit();
+
+        out << toy << "\t" << func_min.IsValid() << "\t" << std::setprecision(10) << func_min.Fval() << "\t"
+            << func_min.Edm();
+        for(size_t k = 0; k < floated.size(); k++) {
+            fptype err  = floated[k].getError();
+            fptype pull = err > 0 ? (floated[k].getValue() - truth[k]) / err : 0;
+            out << "\t" << floated[k].getValue() << "\t" << err << "\t" << pull;
+        }
+        out << std::endl;
+
+        GOOFIT_INFO("Toy {}/{}: NLL = {}, valid = {}", toy + 1, nToys, func_min.Fval(), func_min.IsValid());
+    }
+
+    out.close();
+}
+
+
+
+// Distributed host likelihood: only rank 0 runs Minuit2. Each of its evaluations is sent with
+// the coefficients to the other processes, which evaluate their events in step (the
+// likelihood's block exchange is collective) until rank 0 sends StopServing.
+enum LikelihoodCommand { StopServing, EvaluateNll, EvaluateScores };
 
-    GooFit::Application app{"D2PPP",argc,argv};
+#ifdef D2PPP_MPI
+void broadcastCommand(int header[2], std::vector<double> &par){
 
-    app.add_flag("--bkgOn", bkgOn, "Turn on background (requires file)");
+    MPI_Bcast(header, 2, MPI_INT, 0, MPI_COMM_WORLD);
+    if(header[0] != StopServing)
+        MPI_Bcast(par.data(), par.size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+}
 
-    size_t  nevents = 100000;
+void sendCommand(int command, bool grad, const double *re, const double *im, size_t n){
 
-    auto gen = app.add_subcommand("gen","generate toy data");
-    gen->add_option("-e,--events",nevents,"The number of events to generate",true);
+    int header[2] = {command, grad};
+    std::vector<double> par(re, re + n);
+    par.insert(par.end(), im, im + n);
+    broadcastCommand(header, par);
+}
+#endif
 
-    auto toyfit = app.add_subcommand("fit","fit toy data/toyMC");
+double distributedNll(const MIPWALikelihood &lik, const double *re, const double *im, double *gre, double *gim){
 
-    auto plot = app.add_subcommand("plot","plot signal");
+#ifdef D2PPP_MPI
+    if(mpiSize() > 1)
+        sendCommand(EvaluateNll, gre && gim, re, im, lik.numKnots());
+#endif
+    return lik.nll(re, im, gre, gim);
+}
 
+std::vector<double> distributedScoreCovariance(const MIPWALikelihood &lik, const double *re, const double *im){
 
-    GOOFIT_PARSE(app);
+#ifdef D2PPP_MPI
+    if(mpiSize() > 1)
+        sendCommand(EvaluateScores, false, re, im, lik.numKnots());
+#endif
+    return lik.scoreCovariance(re, im);
+}
+
+void stopServing(){
 
-    /// Make the plot directory if it does not exist
-    std::string command = "mkdir -p plots";
-    if(system(command.c_str()) != 0)
-        throw GooFit::GeneralError("Making `plots` directory failed");
+#ifdef D2PPP_MPI
+    if(mpiSize() > 1) {
+        int header[2] = {StopServing, 0};
+        std::vector<double> none;
+        broadcastCommand(header, none);
+    }
+#endif
+}
 
-    if(*gen){
-        CLI::AutoTimer timer("MC Generation");
-        runtoygen("D2PPP_toy.txt",nevents);
+#ifdef D2PPP_MPI
+// Loop of the processes other than rank 0
+void serveLikelihood(const MIPWALikelihood &lik){
+
+    size_t n = lik.numKnots();
+    std::vector<double> par(2 * n), gre(n), gim(n);
+    for(;;) {
+        int header[2];
+        broadcastCommand(header, par);
+        if(header[0] == StopServing)
+            return;
+        if(header[0] == EvaluateNll)
+            lik.nll(par.data(), par.data() + n, header[1] ? gre.data() : nullptr, header[1] ? gim.data() : nullptr);
+        else
+            lik.scoreCovariance(par.data(), par.data() + n);
+    }
+}
+#endif
+
+// Minuit2 function for the host MIPWA likelihood. The parameters are the spline coefficients,
+// interleaved real/imaginary and named as in loadPWAResonance(). The analytic gradient comes
+// out of the same pass over the events as the value; Minuit2 asks for the value and the
+// gradient at the same point separately, so the last pair is kept.
+class MIPWAFCN : public ROOT::Minuit2::FCNGradientBase {
+  public:
+    explicit MIPWAFCN(const MIPWALikelihood &lik) : lik_(lik) {}
+
+    double operator()(const std::vector<double> &par) const override {
+        evaluate(par);
+        return lastValue_;
     }
 
-    if(*toyfit){
-        CLI::AutoTimer timer("FIT");
-        runtoyfit("D2PPP_toy.txt");
+    std::vector<double> Gradient(const std::vector<double> &par) const override {
+        evaluate(par);
+        return lastGradient_;
     }
 
-    
-    if(*plot){
-        CLI::AutoTimer timer("FIT");
-        runMakeToyDalitzPdfPlots("D2PPP_toy.txt");
+    bool CheckGradient() const override { return false; }
+
+    double Up() const override { return 0.5; }
+
+  private:
+    void evaluate(const std::vector<double> &par) const {
+        if(par == lastPar_)
+            return;
+
+        size_t n = lik_.numKnots();
+        std::vector<double> re(n), im(n), gre(n), gim(n);
+        for(size_t k = 0; k < n; k++) {
+            re[k] = par[2 * k];
+            im[k] = par[2 * k + 1];
+        }
+
+        lastValue_ = distributedNll(lik_, re.data(), im.data(), gre.data(), gim.data());
+        lastGradient_.resize(2 * n);
+        for(size_t k = 0; k < n; k++) {
+            lastGradient_[2 * k]     = gre[k];
+            lastGradient_[2 * k + 1] = gim[k];
+        }
+        lastPar_ = par;
+    }
+
+    const MIPWALikelihood &lik_;
+    mutable std::vector<double> lastPar_;
+    mutable std::vector<double> lastGradient_;
+    mutable double lastValue_ = 0;
+};
+
+ROOT::Minuit2::MnUserParameters makeMIPWAParameters(){
+
+    ROOT::Minuit2::MnUserParameters upar;
+    for(size_t k = 0; k < pwa_coefs_amp.size(); k++) {
+        for(const Variable &v : {pwa_coefs_amp[k], pwa_coefs_phs[k]}) {
+            upar.Add(v.getName(), v.getValue(), v.getError(), v.getLowerLimit(), v.getUpperLimit());
+            if(v.IsFixed())
+                upar.Fix(upar.Index(v.getName()));
+        }
+    }
+    return upar;
+}
+
+void setMIPWAResults(const ROOT::Minuit2::MnUserParameters &upar){
+
+    for(size_t k = 0; k < pwa_coefs_amp.size(); k++) {
+        for(Variable v : {pwa_coefs_amp[k], pwa_coefs_phs[k]}) {
+            unsigned int idx = upar.Index(v.getName());
+            v.setValue(upar.Value(idx));
+            v.setError(upar.Error(idx));
+        }
+    }
+}
+
+// Sandwich errors of a weighted host-likelihood fit, V = H^-1 C H^-1: H^-1 is the Migrad
+// covariance (with Up = 0.5 the inverse Hessian of the NLL) and C the covariance of the
+// per-event scores. The weighted NLL alone would give errors scaled as if the sum of weights
+// were the sample size. Fixed parameters keep their errors.
+ROOT::Minuit2::MnUserParameters sandwichParameters(const MIPWALikelihood &lik, const ROOT::Minuit2::MnUserParameterState &state){
+
+    ROOT::Minuit2::MnUserParameters upar = state.Parameters();
+    if(!state.HasCovariance()) {
+        GOOFIT_WARN("No covariance from the fit, the weighted-fit errors are not corrected");
+        return upar;
+    }
+
+    size_t n = lik.numKnots();
+    std::vector<double> re(n), im(n);
+    for(size_t k = 0; k < n; k++) {
+        re[k] = upar.Value(2 * k);
+        im[k] = upar.Value(2 * k + 1);
+    }
+    std::vector<double> c = distributedScoreCovariance(lik, re.data(), im.data());
+
+    // Free parameters in internal order; parameter 2k is re_k and 2k+1 im_k, (re, im) in c
+    std::vector<size_t> ext, knot;
+    for(const ROOT::Minuit2::MinuitParameter &p : upar.Parameters())
+        if(!p.IsFixed() && !p.IsConst()) {
+            ext.push_back(p.Number());
+            knot.push_back(p.Number() % 2 ? n + p.Number() / 2 : p.Number() / 2);
+        }
+
+    const ROOT::Minuit2::MnUserCovariance &cov = state.Covariance();
+    size_t nf = ext.size();
+    std::vector<double> hc(nf * nf, 0.0);
+    for(size_t i = 0; i < nf; i++)
+        for(size_t k = 0; k < nf; k++)
+            for(size_t j = 0; j < nf; j++)
+                hc[i * nf + j] += cov(i, k) * c[knot[k] * 2 * n + knot[j]];
+
+    for(size_t i = 0; i < nf; i++) {
+        double v = 0;
+        for(size_t j = 0; j < nf; j++)
+            v += hc[i * nf + j] * cov(j, i);
+        GOOFIT_INFO("{}: error {} (uncorrected {})", upar.Name(ext[i]), std::sqrt(v), upar.Error(ext[i]));
+        upar.SetError(ext[i], std::sqrt(v));
+    }
+    return upar;
+}
+
+// K Migrad fits of the host likelihood from scattered starting points. Start 0 is the given
+// point; the other K - 1 are Latin-hypercube (or uniform) points in a box around it of half-width
+// spread x the Variable limit range, clipped to the limits, drawn from Philox streams of the
+// seed. The fits share the read-only likelihood (event table and normalisation matrix) and
+// run concurrently in rounds of `stretch` calls; after each round a start whose NLL is more
+// than killDelta above the best and improved by less than a tenth of that gap is dropped.
+// Rounds make the outcome independent of the thread count. Ranked minima go to the output
+// table; the best minimum is returned.
+ROOT::Minuit2::FunctionMinimum multiStartFit(const MIPWALikelihood &lik, const ROOT::Minuit2::MnUserParameters &upar){
+
+    const size_t K = std::max(1u, multi_start.starts);
+
+    std::vector<unsigned int> free;
+    for(const auto &p : upar.Parameters())
+        if(!p.IsFixed() && !p.IsConst())
+            free.push_back(p.Number());
+    const size_t D = free.size();
+
+    auto uniform = [](uint32_t a, uint32_t b, uint32_t stream) {
+        const uint32_t key[2] = {multi_start.seed, stream};
+        const uint32_t ctr[4] = {a, b, 0, 0};
+        uint32_t r[4];
+        philox4x32(ctr, key, r);
+        return (r[0] + 0.5) * (1.0 / 4294967296.0);
+    };
+
+    // Unit-cube points of starts 1..K-1: stratum perm_d[j] of K - 1 in each dimension d,
+    // jittered inside it. Start 0 takes no stratum, so the scattered starts cover all of them.
+    const size_t M = K - 1;
+    std::vector<std::vector<double>> unit(M, std::vector<double>(D));
+    for(size_t d = 0; d < D && M > 0; d++) {
+        std::vector<size_t> perm(M);
+        for(size_t j = 0; j < M; j++)
+            perm[j] = j;
+        for(size_t j = M - 1; j > 0; j--)
+            std::swap(perm[j], perm[std::min<size_t>(j, uniform(d, j, 1) * (j + 1))]);
+        for(size_t j = 0; j < M; j++)
+            unit[j][d] = multi_start.random ? uniform(j, d, 2) : (perm[j] + uniform(j, d, 2)) / M;
+    }
+
+    enum Status { Running, Converged, CallLimit, Killed };
+    const char *statusName[] = {"running", "converged", "call limit", "killed"};
+
+    struct Start {
+        ROOT::Minuit2::MnUserParameterState state;
+        std::unique_ptr<ROOT::Minuit2::FunctionMinimum> minimum;
+        Status status     = Running;
+        double fval       = 0;
+        double lastGain   = 0;
+        unsigned int nFcn = 0;
+    };
+
+    std::vector<Start> starts(K);
+    for(size_t k = 0; k < K; k++) {
+        ROOT::Minuit2::MnUserParameters p = upar;
+        for(size_t d = 0; k > 0 && d < D; d++) {
+            const auto &par = upar.Parameters()[free[d]];
+            double lo = par.HasLimits() ? par.LowerLimit() : par.Value() - 1;
+            double hi = par.HasLimits() ? par.UpperLimit() : par.Value() + 1;
+            double w  = multi_start.spread * 0.5 * (hi - lo);
+            double a  = std::max(lo, par.Value() - w);
+            double b  = std::min(hi, par.Value() + w);
+            p.SetValue(free[d], a + (b - a) * unit[k - 1][d]);
+        }
+        starts[k].state = ROOT::Minuit2::MnUserParameterState(p);
+    }
+
+    const unsigned int maxCalls = 200 + 100 * D + 5 * D * D;
+
+    for(size_t round = 0;; round++) {
+        std::vector<size_t> live;
+        for(size_t k = 0; k < K; k++)
+            if(starts[k].status == Running)
+                live.push_back(k);
+        if(live.empty())
+            break;
+
+        // Concurrent stretches; the likelihood's own loops run serially inside each
+#pragma omp parallel for schedule(dynamic, 1)
+        for(long i = 0; i < (long)live.size(); i++) {
+            Start &s = starts[live[i]];
+            MIPWAFCN fcn(lik);
+            ROOT::Minuit2::MnMigrad migrad(fcn, s.state);
+            auto func_min = migrad(std::min(multi_start.stretch, maxCalls - s.nFcn));
+
+            s.lastGain = s.minimum ? s.fval - func_min.Fval() : 0;
+            s.fval     = func_min.Fval();
+            s.nFcn += func_min.NFcn();
+            s.state = func_min.UserState();
+            s.minimum.reset(new ROOT::Minuit2::FunctionMinimum(func_min));
+            if(!func_min.HasReachedCallLimit())
+                s.status = Converged;
+            else if(s.nFcn >= maxCalls)
+                s.status = CallLimit;
+        }
+
+        double best = starts[live[0]].fval;
+        for(const Start &s : starts)
+            if(s.minimum)
+                best = std::min(best, s.fval);
+
+        size_t killed = 0;
+        for(size_t k : live) {
+            Start &s  = starts[k];
+            double gap = s.fval - best;
+            if(s.status == Running && round > 0 && gap > multi_start.killDelta && s.lastGain < 0.1 * gap) {
+                s.status = Killed;
+                killed++;
+            }
+        }
+
+        GOOFIT_INFO("Multi-start round {}: {} running, best NLL = {}, {} dropped", round, live.size(), best, killed);
+    }
+
+    std::vector<size_t> rank(K);
+    for(size_t k = 0; k < K; k++)
+        rank[k] = k;
+    std::stable_sort(rank.begin(), rank.end(), [&](size_t a, size_t b) {
+        bool ka = starts[a].status == Killed, kb = starts[b].status == Killed;
+        return ka != kb ? kb : starts[a].fval < starts[b].fval;
+    });
+
+    std::ofstream out(multi_start.output.c_str());
+    out << "rank\tstart\tnll\tdnll\tedm\tvalid\tcalls\tstatus\n";
+    for(size_t r = 0; r < K; r++) {
+        const Start &s = starts[rank[r]];
+        out << r << "\t" << rank[r] << "\t" << std::setprecision(10) << s.fval << "\t"
+            << s.fval - starts[rank[0]].fval << "\t" << s.minimum->Edm() << "\t" << s.minimum->IsValid() << "\t"
+            << s.nFcn << "\t" << statusName[s.status] << '\n';
+        if(r < 10)
+            GOOFIT_INFO("#{} start {}: NLL = {} (+{}), {} calls, {}", r, rank[r], s.fval,
+                        s.fval - starts[rank[0]].fval, s.nFcn, statusName[s.status]);
+    }
+
+    return *starts[rank[0]].minimum;
+}
+
+// Compares a double- and a single-precision-table fit from the same start: per parameter the
+// two values and errors and the shift in units of the double error
+void writePrecisionReport(const string &fname, const ROOT::Minuit2::FunctionMinimum &dbl,
+                          const ROOT::Minuit2::FunctionMinimum &sgl){
+
+    std::ofstream out(fname.c_str());
+    out << "# nll_double " << std::setprecision(15) << dbl.Fval() << " nll_single " << sgl.Fval() << " delta "
+        << sgl.Fval() - dbl.Fval() << '\n';
+    out << "parameter\tdouble\tdouble_err\tsingle\tsingle_err\tshift_sigma\n";
+
+    double worst = 0;
+    const ROOT::Minuit2::MnUserParameters &a = dbl.UserParameters();
+    const ROOT::Minuit2::MnUserParameters &b = sgl.UserParameters();
+    for(const ROOT::Minuit2::MinuitParameter &p : a.Parameters()) {
+        if(p.IsFixed() || p.IsConst())
+            continue;
+        unsigned int k = p.Number();
+        double shift   = a.Error(k) > 0 ? (b.Value(k) - a.Value(k)) / a.Error(k) : 0;
+        worst          = std::max(worst, std::fabs(shift));
+        out << p.Name() << "\t" << std::setprecision(10) << a.Value(k) << "\t" << a.Error(k) << "\t" << b.Value(k)
+            << "\t" << b.Error(k) << "\t" << shift << '\n';
+    }
+
+    GOOFIT_INFO("Precision validation: NLL shift {}, largest parameter shift {} sigma, report in {}",
+                sgl.Fval() - dbl.Fval(), worst, fname);
+}
+
+// Signal-only MIPWA fit on the host likelihood, with the normalisation as a precomputed
+// quadratic form in the spline coefficients. The grid is the same s12 x s13 bin-centre grid
+// DalitzPlotPdf integrates over, so the minimum agrees with runtoyfit(). With normTol > 0 the
+// grid is instead refined adaptively at the starting coefficients to that relative accuracy.
+// With nBins > 0 the events are histogrammed on an nBins x nBins grid and the fit is the
+// binned extended likelihood of MIPWALikelihood::setBinnedEvents(), whose bin integrals
+// replace the normalisation; its cost no longer grows with the sample size.
+// Under MPI each process holds a share of the events (see getdata()) and the fixed-grid
+// normalisation is split between them; rank 0 runs the fit and the plots.
+void runquadnormfit(std::string name, double normTol, size_t nBins){
+
+    if(bkgOn)
+        throw GooFit::GeneralError("--quadNorm fits the signal S-wave only, drop --bkgOn");
+
+    s12.setNumBins(1500);
+    s13.setNumBins(1500);
+
+    getdata(name);
+
+    GOOFIT_INFO("Number of Events in dataset: {}", data_total_events);
+
+    signaldalitz = makesignalpdf(0);
+
+    auto inside = [](double x, double y) { return inDalitz(x, y, D_MASS, d1_MASS, d2_MASS, d3_MASS); };
+
+    if(nBins > 0 && !event_weights.empty())
+        throw GooFit::GeneralError("--binned does not take --weight: the bin counts would need sum w^2 errors");
+
+    MIPWALikelihood lik(HH_bin_limits);
+    lik.setSymmetric(symmetricOn);
+#ifdef D2PPP_MPI
+    MPIExchange exchange;
+    if(mpiSize() > 1)
+        lik.setPartition(&exchange, data_first_event, data_total_events);
+#endif
+    std::vector<double> x = dataColumn(s12), y = dataColumn(s13);
+    auto setTable = [&](bool single) {
+        lik.setSinglePrecision(single);
+        if(nBins > 0) {
+            CLI::AutoTimer timer("Binned likelihood");
+            size_t dropped = lik.setBinnedEvents(x, y, nBins, s12.getLowerLimit(), s12.getUpperLimit(), nBins,
+                                                 s13.getLowerLimit(), s13.getUpperLimit(), inside);
+            GOOFIT_INFO("Binned fit: {} bins inside the phase space, {} integration points, {} events dropped",
+                        lik.numBins(), lik.numEvents(), dropped);
+        } else
+            lik.setEvents(x, y, event_weights);
+    };
+    setTable(fit_precision.single);
+
+    if(lik.weighted())
+        GOOFIT_INFO("Weighted fit: sum of weights {} over {} events", lik.sumOfWeights(), lik.numEvents());
+
+    auto upar = makeMIPWAParameters();
+
+    if(!lik.binned()) {
+        CLI::AutoTimer timer("Normalisation overlap matrix");
+        if(normTol > 0) {
+            size_t n = lik.numKnots();
+            std::vector<double> re(n), im(n);
+            for(size_t k = 0; k < n; k++) {
+                re[k] = upar.Value(2 * k);
+                im[k] = upar.Value(2 * k + 1);
+            }
+            size_t evaluations = lik.buildNormalizationAdaptive(s12.getLowerLimit(), s12.getUpperLimit(),
+                                                                s13.getLowerLimit(), s13.getUpperLimit(),
+                                                                inside, re.data(), im.data(), normTol);
+            GOOFIT_INFO("Adaptive normalisation: {} amplitude evaluations ({} on the {}x{} grid)",
+                        evaluations, s12.getNumBins() * s13.getNumBins(), s12.getNumBins(), s13.getNumBins());
+        } else {
+            lik.buildNormalization(s12.getNumBins(), s12.getLowerLimit(), s12.getUpperLimit(),
+                                   s13.getNumBins(), s13.getLowerLimit(), s13.getUpperLimit(), inside);
+        }
+    }
+
+#ifdef D2PPP_MPI
+    if(mpiRank() > 0) {
+        serveLikelihood(lik);
+        gatherRows(x);
+        gatherRows(y);
+        return;
+    }
+#endif
+
+    saveParameters(upar.Parameters(), "Parametros_iniciais.txt");
+
+    MIPWAFCN fcn(lik);
+    auto start    = fitStartState(upar);
+    auto func_min = multi_start.starts > 0 ? multiStartFit(lik, start.Parameters()) : migradWithCheckpoints(fcn, start);
+
+    GOOFIT_INFO("MIPWA fit: NLL = {}, EDM = {}, valid = {}", func_min.Fval(), func_min.Edm(), func_min.IsValid());
+
+    // Weighted fits take the sandwich errors, in the Variables and in Parametros_fit.txt alike
+    auto result = lik.weighted() ? sandwichParameters(lik, func_min.UserState()) : func_min.UserParameters();
+    setMIPWAResults(result);
+    stopServing();
+
+#ifdef D2PPP_MPI
+    if(mpiSize() > 1) {
+        // The plots take the whole sample
+        std::vector<double> allX = gatherRows(x), allY = gatherRows(y), index(allX.size());
+        for(size_t i = 0; i < index.size(); i++)
+            index[i] = i;
+        delete Data;
+        Data = new UnbinnedDataSet({s12,s13,eventNumber});
+        fillDataSet(Data, {s12, s13, eventNumber}, {allX.data(), allY.data(), index.data()}, index.size());
+    }
+#endif
+
+    if(!fit_precision.validate.empty()) {
+        CLI::AutoTimer timer("Precision validation fit");
+        setTable(!fit_precision.single);
+        MIPWAFCN other(lik);
+        auto other_min = ROOT::Minuit2::MnMigrad(other, start)();
+        if(fit_precision.single)
+            writePrecisionReport(fit_precision.validate, other_min, func_min);
+        else
+            writePrecisionReport(fit_precision.validate, func_min, other_min);
+    }
+
+    Variable constant("constant",1);
+    std::vector<Variable> weights;
+    weights.push_back(constant);
+
+    comps.clear();
+    comps.push_back(signaldalitz);
+
+    AddPdf* overallPdf = new AddPdf("overallPdf",weights,comps);
+    overallPdf->setData(Data);
+    signaldalitz->setDataSize(Data->getNumEvents());
+
+    makeToyDalitzPdfPlots(overallPdf);
+
+    saveParameters(result.Parameters(), "Parametros_fit.txt");
+}
+
+
+// S-wave coefficients of any number of fits, fit-major: knot k of fit f at f * knots + k
+struct CoefficientSet {
+    size_t knots = 0;
+    std::vector<double> re, im, reErr, imErr;
+
+    size_t fits() const { return knots ? re.size() / knots : 0; }
+
+    void add(double r, double i, double re_e, double im_e) {
+        re.push_back(r);
+        im.push_back(i);
+        reErr.push_back(re_e);
+        imErr.push_back(im_e);
     }
+};
+
+// Splits a whole file into lines of whitespace-separated fields, read in one go
+std::vector<std::vector<string>> readFields(const string &fname){
+
+    std::ifstream in(fname.c_str());
+    if(!in)
+        throw GooFit::GeneralError("Cannot open {}", fname);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::vector<std::vector<string>> lines;
+    std::istringstream ls(text);
+    for(string line; std::getline(ls, line);) {
+        std::istringstream fs(line);
+        std::vector<string> fields{std::istream_iterator<string>(fs), std::istream_iterator<string>()};
+        if(!fields.empty())
+            lines.push_back(std::move(fields));
+    }
+    return lines;
+}
+
+// Appends the fits of `fname` to `set`. Reads saveParameters() output (index, re, im, re error,
+// im error per knot; fits appended to the same file restart at index 0) and runtoystudy()
+// tables (one fit per row, pwa_coef_<k>_real/_img value and error columns).
+void readCoefficients(const string &fname, CoefficientSet &set){
+
+    auto lines = readFields(fname);
+    size_t before = set.re.size();
+    size_t knots  = 0;
+
+    if(!lines.empty() && lines[0][0] == "toy") {
+        const auto &header = lines[0];
+        auto column = [&](const string &name) {
+            auto it = std::find(header.begin(), header.end(), name);
+            return it == header.end() ? -1 : long(it - header.begin());
+        };
+        std::vector<long> cols;
+        for(;; knots++) {
+            long r = column(fmt::format("pwa_coef_{}_real_val", knots));
+            long i = column(fmt::format("pwa_coef_{}_img_val", knots));
+            if(r < 0 || i < 0)
+                break;
+            cols.insert(cols.end(), {r, i, r + 1, i + 1});
+        }
+        for(size_t l = 1; l < lines.size(); l++)
+            for(size_t k = 0; k < knots; k++)
+                set.add(std::stod(lines[l][cols[4 * k]]), std::stod(lines[l][cols[4 * k + 1]]),
+                        std::stod(lines[l][cols[4 * k + 2]]), std::stod(lines[l][cols[4 * k + 3]]));
+    } else {
+        for(const auto &f : lines) {
+            if(f.size() < 5)
+                throw GooFit::GeneralError("{}: expected index, re, im and their errors per line", fname);
+            size_t index = std::stoul(f[0]);
+            if(index == 0 && set.re.size() > before && !knots)
+                knots = set.re.size() - before;
+            set.add(std::stod(f[1]), std::stod(f[2]), std::stod(f[3]), std::stod(f[4]));
+        }
+        if(!knots)
+            knots = set.re.size() - before;
+    }
+
+    if(knots == 0 || (set.re.size() - before) % knots != 0)
+        throw GooFit::GeneralError("{}: no complete set of coefficients", fname);
+    if(set.knots && set.knots != knots)
+        throw GooFit::GeneralError("{} has {} knots, other fits have {}", fname, knots, set.knots);
+    set.knots = knots;
+}
 
+// Magnitude and phase (degrees) of every coefficient, with errors propagated from the
+// uncorrelated re/im errors
+struct PolarSet {
+    std::vector<double> mag, magErr, phase, phaseErr;
+};
+
+PolarSet toPolar(const CoefficientSet &set){
+
+    size_t n = set.re.size();
+    PolarSet p;
+    p.mag.resize(n);
+    p.magErr.resize(n);
+    p.phase.resize(n);
+    p.phaseErr.resize(n);
+
+    const double deg = 180.0 / M_PI;
+    for(size_t i = 0; i < n; i++) {
+        double x = set.re[i], y = set.im[i];
+        double a2 = x * x + y * y;
+        double a  = std::sqrt(a2);
+        p.mag[i]      = a;
+        p.magErr[i]   = a > 0 ? std::sqrt(POW2(x * set.reErr[i]) + POW2(y * set.imErr[i])) / a : 0;
+        p.phase[i]    = std::atan2(y, x) * deg;
+        p.phaseErr[i] = a2 > 0 ? std::sqrt(POW2(y * set.reErr[i]) + POW2(x * set.imErr[i])) / a2 * deg : 0;
+    }
+    return p;
+}
+
+// Per knot over the fits: mean and RMS of `v`
+void knotMoments(const std::vector<double> &v, size_t knots, std::vector<double> &mean, std::vector<double> &rms){
+
+    size_t fits = v.size() / knots;
+    mean.assign(knots, 0.0);
+    rms.assign(knots, 0.0);
+    for(size_t f = 0; f < fits; f++)
+        for(size_t k = 0; k < knots; k++)
+            mean[k] += v[f * knots + k];
+    for(size_t k = 0; k < knots; k++)
+        mean[k] /= fits;
+    for(size_t f = 0; f < fits; f++)
+        for(size_t k = 0; k < knots; k++)
+            rms[k] += POW2(v[f * knots + k] - mean[k]);
+    for(size_t k = 0; k < knots; k++)
+        rms[k] = std::sqrt(rms[k] / fits);
+}
+
+void drawKnotGraphs(const string &fname, const string &title, const std::vector<double> &x,
+                    const std::vector<std::pair<const std::vector<double> *, const std::vector<double> *>> &series,
+                    const std::vector<string> &labels, const string &xtitle = "Knot"){
+
+    const Color_t colors[] = {kRed, kViolet, kBlue, kGreen + 2};
+    std::vector<double> ex(x.size(), 0.0);
+
+    TCanvas c("c", "", 900, 500);
+    c.SetGridy();
+    TLegend legend(0.8, 0.8, 0.98, 0.95);
+    std::vector<std::unique_ptr<TGraphErrors>> graphs;
+    for(size_t s = 0; s < series.size(); s++) {
+        graphs.emplace_back(
+            new TGraphErrors(x.size(), x.data(), series[s].first->data(), ex.data(), series[s].second->data()));
+        TGraphErrors *g = graphs.back().get();
+        g->SetMarkerStyle(20);
+        g->SetMarkerSize(0.7);
+        g->SetMarkerColor(colors[s % 4]);
+        g->SetLineColor(colors[s % 4]);
+        g->SetTitle(title.c_str());
+        g->GetXaxis()->SetTitle(xtitle.c_str());
+        g->Draw(s == 0 ? "AP" : "P same");
+        if(!labels.empty())
+            legend.AddEntry(g, labels[s].c_str(), "lp");
+    }
+    if(!labels.empty())
+        legend.Draw();
+    c.SaveAs(fname.c_str());
+}
+
+// Compares the fitted S-wave coefficients of any number of fits with the reference (the last
+// fit in `reference`, by default the starting values): magnitudes, phases, their shifts and,
+// with several fits, the pulls. All plots are written to plotdir in one pass and the per-knot
+// summary to `output`. With two toy files their s12 distributions are also compared, and the
+// knots of `coefs` are drawn.
+void runcompare(const string &reference, const std::vector<string> &fitFiles, const string &output,
+                const std::vector<string> &toys, const string &coefs, const string &plotdir){
+
+    CoefficientSet ref, fits;
+    readCoefficients(reference, ref);
+    for(const string &f : fitFiles)
+        readCoefficients(f, fits);
+    if(ref.knots != fits.knots)
+        throw GooFit::GeneralError("The reference has {} knots, the fits {}", ref.knots, fits.knots);
+
+    const size_t K = fits.knots, F = fits.fits();
+    GOOFIT_INFO("Comparing {} fits of {} knots with {}", F, K, reference);
+
+    // Last reference fit, and the polar form of every fit at once
+    PolarSet r = toPolar(ref), p = toPolar(fits);
+    size_t last = (ref.fits() - 1) * K;
+    for(auto *v : {&r.mag, &r.magErr, &r.phase, &r.phaseErr})
+        v->erase(v->begin(), v->begin() + last);
+
+    // Shifts (reference - fit, phase wrapped to +-180 degrees) and pulls of all fits
+    std::vector<double> dMag(F * K), dPhase(F * K), pMag(F * K), pPhase(F * K);
+    for(size_t i = 0; i < F * K; i++) {
+        size_t k   = i % K;
+        double d   = r.phase[k] - p.phase[i];
+        dMag[i]    = r.mag[k] - p.mag[i];
+        dPhase[i]  = d - 360.0 * std::round(d / 360.0);
+        double em  = std::sqrt(POW2(r.magErr[k]) + POW2(p.magErr[i]));
+        double ep  = std::sqrt(POW2(r.phaseErr[k]) + POW2(p.phaseErr[i]));
+        pMag[i]    = em > 0 ? dMag[i] / em : 0;
+        pPhase[i]  = ep > 0 ? dPhase[i] / ep : 0;
+    }
+
+    std::vector<double> magMean, magRms, phaseMean, phaseRms, dMagMean, dMagRms, dPhaseMean, dPhaseRms;
+    std::vector<double> pMagMean, pMagRms, pPhaseMean, pPhaseRms;
+    knotMoments(p.mag, K, magMean, magRms);
+    knotMoments(p.phase, K, phaseMean, phaseRms);
+    knotMoments(dMag, K, dMagMean, dMagRms);
+    knotMoments(dPhase, K, dPhaseMean, dPhaseRms);
+    knotMoments(pMag, K, pMagMean, pMagRms);
+    knotMoments(pPhase, K, pPhaseMean, pPhaseRms);
+
+    // One fit keeps its own errors; several show their spread, and the shifts the error on the mean
+    std::vector<double> magErr = magRms, phaseErr = phaseRms, dMagErr(K), dPhaseErr(K);
+    for(size_t k = 0; k < K; k++) {
+        if(F == 1) {
+            magErr[k]    = p.magErr[k];
+            phaseErr[k]  = p.phaseErr[k];
+            dMagErr[k]   = std::sqrt(POW2(r.magErr[k]) + POW2(p.magErr[k]));
+            dPhaseErr[k] = std::sqrt(POW2(r.phaseErr[k]) + POW2(p.phaseErr[k]));
+        } else {
+            dMagErr[k]   = dMagRms[k] / std::sqrt(F);
+            dPhaseErr[k] = dPhaseRms[k] / std::sqrt(F);
+        }
+    }
+
+    std::vector<double> knot(K);
+    for(size_t k = 0; k < K; k++)
+        knot[k] = k;
+
+    std::vector<string> labels = {"Reference", F == 1 ? "Fit" : fmt::format("{} fits", F)};
+    drawKnotGraphs(plotdir + "/compare_magnitude.png", "Magnitude", knot, {{&r.mag, &r.magErr}, {&magMean, &magErr}}, labels);
+    drawKnotGraphs(plotdir + "/compare_phase.png", "Phase", knot, {{&r.phase, &r.phaseErr}, {&phaseMean, &phaseErr}}, labels);
+    drawKnotGraphs(plotdir + "/compare_shiftmag.png", "Shift of S-Wave Magnitude", knot, {{&dMagMean, &dMagErr}}, {});
+    drawKnotGraphs(plotdir + "/compare_shiftphase.png", "Shift of S-Wave Phase", knot, {{&dPhaseMean, &dPhaseErr}}, {});
+    if(F > 1) {
+        drawKnotGraphs(plotdir + "/compare_pullmag.png", "Pull of S-Wave Magnitude", knot, {{&pMagMean, &pMagRms}}, {});
+        drawKnotGraphs(plotdir + "/compare_pullphase.png", "Pull of S-Wave Phase", knot, {{&pPhaseMean, &pPhaseRms}}, {});
+    }
+
+    std::ofstream out(output.c_str());
+    out << "knot\tref_mag\tref_phase\tmag\tmag_err\tphase\tphase_err\tshift_mag\tshift_mag_err\tshift_phase\t"
+           "shift_phase_err\tpull_mag_mean\tpull_mag_rms\tpull_phase_mean\tpull_phase_rms\n";
+    for(size_t k = 0; k < K; k++)
+        out << k << "\t" << std::setprecision(8) << r.mag[k] << "\t" << r.phase[k] << "\t" << magMean[k] << "\t"
+            << magErr[k] << "\t" << phaseMean[k] << "\t" << phaseErr[k] << "\t" << dMagMean[k] << "\t" << dMagErr[k]
+            << "\t" << dPhaseMean[k] << "\t" << dPhaseErr[k] << "\t" << pMagMean[k] << "\t" << pMagRms[k] << "\t"
+            << pPhaseMean[k] << "\t" << pPhaseRms[k] << '\n';
+    out.close();
+
+    // Knots of the PWA input
+    if(!coefs.empty()) {
+        std::vector<double> mass, re, im;
+        for(const auto &f : readFields(coefs)) {
+            mass.push_back(std::stod(f.at(0)));
+            re.push_back(std::stod(f.at(1)));
+            im.push_back(std::stod(f.at(2)));
+        }
+        CoefficientSet in;
+        for(size_t k = 0; k < mass.size(); k++)
+            in.add(re[k], im[k], 0, 0);
+        PolarSet c = toPolar(in);
+        string xtitle = "m^{2}(#pi^{-}#pi^{+}) GeV";
+        drawKnotGraphs(plotdir + "/PWACOEFs_magnitude.png", "Magnitude", mass, {{&c.mag, &c.magErr}}, {}, xtitle);
+        drawKnotGraphs(plotdir + "/PWACOEFs_phase.png", "Phase", mass, {{&c.phase, &c.phaseErr}}, {}, xtitle);
+    }
+
+    // s12 of two toys and their ratio
+    if(!toys.empty()) {
+        if(toys.size() != 2)
+            throw GooFit::GeneralError("--toys takes two toy files, got {}", toys.size());
+
+        std::vector<std::unique_ptr<TH1F>> h;
+        for(size_t t = 0; t < 2; t++) {
+            std::unique_ptr<UnbinnedDataSet> toy(readToyFile(toys[t]));
+            h.emplace_back(new TH1F(fmt::format("toy_s12_{}", t).c_str(), "", 120, s12.getLowerLimit(), s12.getUpperLimit()));
+            h[t]->Sumw2();
+            for(size_t i = 0; i < toy->getNumEvents(); i++)
+                h[t]->Fill(toy->getValue(s12, i));
+        }
+
+        TCanvas c("c", "", 700, 500);
+        c.SetGridy();
+        gStyle->SetOptStat(0);
+        h[0]->Divide(h[1].get());
+        h[0]->SetTitle(fmt::format("{} / {}", toys[0], toys[1]).c_str());
+        h[0]->GetXaxis()->SetTitle("m^{2}(#pi^{-}#pi^{+}) GeV");
+        h[0]->SetLineColor(kBlue);
+        h[0]->Draw("E");
+        c.SaveAs((plotdir + "/compare_toys_ratio.png").c_str());
+    }
 }
@@ -0,0 +1,151 @@
+#pragma once
+
+// The D -> pi pi pi analysis shared by D2PPP (D2PPP_main.cpp) and D2PPP_bench: the Dalitz-plot
+// globals and the model, data, template and toy builders of D2PPP.cpp, which is built once as
+// the D2PPP_model library.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <RtypesCore.h>
+
+#include <goofit/BinnedDataSet.h>
+#include <goofit/PDFs/physics/DalitzPlotPdf.h>
+#include <goofit/UnbinnedDataSet.h>
+#include <goofit/Variable.h>
+
+class TH2F;
+
+//Globals
+
+extern double D_MASS;
+extern double d1_MASS;
+extern double d2_MASS;
+extern double d3_MASS;
+
+extern bool toyOn;
+extern bool bkgOn;
+extern bool templateCacheOn;
+extern bool symmetricOn;
+
+extern fptype s12_min;
+extern fptype s12_max;
+extern fptype s13_min;
+extern fptype s13_max;
+
+extern GooFit::Observable s12;
+extern GooFit::Observable s13;
+extern GooFit::EventNumber eventNumber;
+
+extern GooFit::DalitzPlotPdf *signaldalitz;
+extern GooFit::UnbinnedDataSet *Data;
+
+extern std::vector<fptype> HH_bin_limits;
+extern std::vector<GooFit::Variable> pwa_coefs_amp;
+extern std::vector<GooFit::Variable> pwa_coefs_phs;
+
+extern std::string pwa_file;
+extern std::string template_cache_dir;
+
+// Entry range, selection and I/O threads used when reading the data tree
+struct TreeSelection {
+    Long64_t firstEntry = 0;
+    Long64_t nEntries   = -1; // all remaining entries
+    Long64_t maxEvents  = -1; // all selected entries
+    std::string cut;
+    unsigned int threads = 0; // 0: all cores
+    int part = 0, parts = 1;  // read only share `part` of `parts` of the entry range
+};
+
+extern TreeSelection data_selection;
+
+// Per-event weight branch of the data tree (e.g. sWeights; empty: unweighted)
+extern std::string weight_branch;
+
+// Migrad checkpoints and warm start
+struct FitCheckpointing {
+    std::string file;         // empty: no checkpoints, one uninterrupted Migrad
+    unsigned int calls = 500; // FCN calls between checkpoints, 0: only at the end
+    bool resume = false;      // start from `file` if it exists
+    std::string warmStart;    // start from this checkpoint
+};
+
+extern FitCheckpointing fit_checkpointing;
+
+// Multi-start MIPWA fits (--quadNorm)
+struct MultiStart {
+    unsigned int starts = 0;     // 0: one fit from the seeds
+    bool random = false;         // uniform instead of Latin-hypercube starting points
+    double spread = 0.05;        // half-width of the start box, as a fraction of each limit range
+    double killDelta = 50;       // NLL gap to the best start beyond which a stalling start is dropped
+    unsigned int stretch = 200;  // FCN calls per round
+    uint32_t seed = 0;
+    std::string output = "D2PPP_multistart.txt";
+};
+
+extern MultiStart multi_start;
+
+// Storage precision of the host likelihood tables (--quadNorm)
+struct FitPrecision {
+    bool single = false;  // single-precision basis table, double sums
+    std::string validate; // refit in the other precision and compare (empty: no report)
+};
+
+extern FitPrecision fit_precision;
+
+//functions
+
+int mpiRank();
+int mpiSize();
+void pinThreads(const std::string &mode);
+
+// Philox4x32-10 counter-based generator
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
+void fillDataSet(GooFit::UnbinnedDataSet *data,
+                 std::vector<GooFit::Observable> obs,
+                 const std::vector<const double *> &columns,
+                 size_t n);
+std::vector<double> dataColumn(const GooFit::Observable &obs);
+
+void fillTemplate(GooFit::BinnedDataSet *binned, TH2F *source, bool swap, fptype smoothing);
+GooFit::DalitzPlotPdf *makesignalpdf(GooFit::GooPdf *eff = 0, const std::vector<std::string> &isobars = {});
+
+// Accept-reject generator over the Dalitz plot with a cached envelope. The PDF is evaluated
+// once on the s12 x s13 bin-centre grid; the envelope of each coarse cell is the maximum over
+// its grid points and their neighbours, times a safety factor. Proposals pick a cell by
+// envelope mass and a uniform point in it, and are evaluated in batches. Proposal k uses
+// only the Philox words of counter k under the key (seed, stream), and batches are accepted
+// in proposal order, so for given PDF values a sample does not depend on the batch size or
+// on how the proposals are spread over threads. The PDF values themselves carry GooFit's
+// normalisation, a parallel reduction whose rounding can change with the thread count or
+// device, so a proposal that lands within rounding of its acceptance threshold may go either
+// way. A PDF value above a cell's envelope raises that cell's envelope and restarts from
+// counter 0.
+class ToyGenerator {
+  public:
+    ToyGenerator(GooFit::GooPdf *pdf, size_t cellBins = 10, double safety = 1.2);
+
+    // Fills s12/s13 with nEvents events. stream separates samples with the same seed (toys).
+    void generate(size_t nEvents, uint32_t seed, uint32_t stream, std::vector<double> &x, std::vector<double> &y);
+
+  private:
+    GooFit::GooPdf *pdf_;
+    size_t nx_, ny_;
+    double x0_, y0_, dx_, dy_;
+    std::vector<double> envelope_;
+};
+
+// Subcommands
+void runtoygen(std::string name, size_t events, std::string textname = "", uint32_t seed = 0);
+void runtoyfit(std::string name, const std::vector<std::string> &isobars = {});
+void runquadnormfit(std::string name, double normTol = 0, size_t nBins = 0);
+void runMakeToyDalitzPdfPlots(std::string name);
+void runtoystudy(size_t nToys, size_t events, std::string outname, uint32_t seed = 0);
+void runcompare(const std::string &reference,
+                const std::vector<std::string> &fitFiles,
+                const std::string &output,
+                const std::vector<std::string> &toys,
+                const std::string &coefs,
+                const std::string &plotdir = "plots");
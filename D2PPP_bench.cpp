@@ -0,0 +1,442 @@
+// Benchmarks of the D2PPP hot paths: the makesignalpdf() model and the host MIPWA likelihood
+// on synthetic phase-space data, swept over event counts, normalisation grids, spline knot
+// counts and isobar sets, plus the toy generator and the template build. With --scaling, a
+// strong/weak scaling sweep over OpenMP thread counts instead.
+//
+// Results are one line per measurement, "benchmark<TAB>parameters<TAB>value<TAB>unit", in a
+// fixed order. With --baseline a previous output is compared line by line and the program
+// fails if any measurement is worse by more than --tolerance.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <TH2F.h>
+
+#include <goofit/Application.h>
+#include <goofit/fitting/FCN.h>
+#include <goofit/fitting/Params.h>
+
+#include "MIPWALikelihood.h"
+#include "D2PPP.h"
+
+struct BenchResult {
+    std::string name;
+    std::string params;
+    double value;
+    std::string unit;
+
+    // Rates (".../s") are better higher, times better lower
+    bool higherIsBetter() const { return unit.size() > 2 && unit.compare(unit.size() - 2, 2, "/s") == 0; }
+};
+
+double benchMinTime = 0.5;
+
+double benchNow(){
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Calls f until benchMinTime has passed (at least twice) and returns calls per second
+template <typename F>
+double benchRate(F f){
+
+    f(); // warm-up: first-call allocations and cache fills
+    size_t calls = 0;
+    double start = benchNow(), elapsed = 0;
+    while(calls < 2 || elapsed < benchMinTime) {
+        f();
+        calls++;
+        elapsed = benchNow() - start;
+    }
+    return calls / elapsed;
+}
+
+// Uniform phase-space events as the fit dataset, from a fixed Philox stream
+void makeBenchData(size_t nEvents){
+
+    std::vector<double> x, y, evts;
+    const uint32_t key[2] = {12345, 0};
+    for(uint64_t k = 0; x.size() < nEvents; k++) {
+        const uint32_t ctr[4] = {uint32_t(k), uint32_t(k >> 32), 0, 0};
+        uint32_t r[4];
+        philox4x32(ctr, key, r);
+        double s12v = s12.getLowerLimit() + (s12.getUpperLimit() - s12.getLowerLimit()) * r[0] / 4294967296.0;
+        double s13v = s13.getLowerLimit() + (s13.getUpperLimit() - s13.getLowerLimit()) * r[1] / 4294967296.0;
+        if(!GooFit::inDalitz(s12v, s13v, D_MASS, d1_MASS, d2_MASS, d3_MASS))
+            continue;
+        x.push_back(s12v);
+        y.push_back(s13v);
+        evts.push_back(evts.size());
+    }
+
+    delete Data;
+    Data = new GooFit::UnbinnedDataSet({s12, s13, eventNumber});
+    fillDataSet(Data, {s12, s13, eventNumber}, {x.data(), y.data(), evts.data()}, nEvents);
+}
+
+// Knot file with nKnots knots spread over the range of the knot file source, coefficients
+// interpolated linearly from it
+std::string makeBenchKnots(const std::string &source, size_t nKnots){
+
+    std::vector<double> x, re, im;
+    {
+        std::ifstream reader(source.c_str());
+        double a, b, c;
+        while(reader >> a >> b >> c) {
+            x.push_back(a);
+            re.push_back(b);
+            im.push_back(c);
+        }
+    }
+    if(x.size() < 2)
+        throw GooFit::GeneralError("{} not found or too short", source);
+
+    std::string fname = fmt::format("D2PPP_bench_knots_{}.txt", nKnots);
+    std::ofstream out(fname.c_str());
+    for(size_t k = 0; k < nKnots; k++) {
+        double s = x.front() + (x.back() - x.front()) * k / (nKnots - 1);
+        size_t i = std::min<size_t>(std::upper_bound(x.begin(), x.end(), s) - x.begin(), x.size() - 1);
+        i        = std::max<size_t>(i, 1);
+        double f = (s - x[i - 1]) / (x[i] - x[i - 1]);
+        out << std::setprecision(10) << s << "\t" << re[i - 1] + f * (re[i] - re[i - 1]) << "\t"
+            << im[i - 1] + f * (im[i] - im[i - 1]) << '\n';
+    }
+    return fname;
+}
+
+// Points signaldalitz at the model of the current knot file and isobar set. The graphs
+// makesignalpdf() builds are never freed, so one is built per change of model; sweep points
+// that change only the data or the grid reuse it.
+void benchSignalPdf(const std::vector<std::string> &isobars = {}){
+
+    static std::string built;
+    std::string model = pwa_file;
+    for(const std::string &r : isobars)
+        model += "+" + r;
+    if(signaldalitz && model == built)
+        return;
+    signaldalitz = makesignalpdf(0, isobars);
+    built        = model;
+}
+
+// GooFit NLL calls per second. Each call moves one spline coefficient, so the cached waves
+// and the normalisation integrals are recomputed as in a fit step.
+double benchGooFitNLL(size_t gridBins, const std::vector<std::string> &isobars = {}){
+
+    s12.setNumBins(gridBins);
+    s13.setNumBins(gridBins);
+    benchSignalPdf(isobars);
+    signaldalitz->setData(Data);
+    signaldalitz->setDataSize(Data->getNumEvents());
+
+    GooFit::Params params(*signaldalitz);
+    GooFit::FCN fcn(params);
+    std::vector<double> pars;
+    for(const auto &p : params.Parameters())
+        pars.push_back(p.Value());
+    unsigned int moved = params.Index(pwa_coefs_amp[pwa_coefs_amp.size() / 2].getName());
+
+    double step = 0;
+    return benchRate([&]() {
+        step = step > 0 ? -1e-4 : 1e-4;
+        pars[moved] += step;
+        fcn(pars);
+    });
+}
+
+// Host MIPWA likelihood (value and gradient) calls per second
+double benchEngineNLL(const MIPWALikelihood &lik){
+
+    size_t n = lik.numKnots();
+    std::vector<double> re(n), im(n), gre(n), gim(n);
+    for(size_t k = 0; k < n; k++) {
+        re[k] = pwa_coefs_amp[k].getValue();
+        im[k] = pwa_coefs_phs[k].getValue();
+    }
+    return benchRate([&]() {
+        re[n / 2] += 1e-4;
+        lik.nll(re.data(), im.data(), gre.data(), gim.data());
+    });
+}
+
+double benchEngineNormalization(MIPWALikelihood &lik, size_t gridBins){
+
+    double start = benchNow();
+    lik.buildNormalization(gridBins, s12.getLowerLimit(), s12.getUpperLimit(), gridBins, s13.getLowerLimit(),
+                           s13.getUpperLimit(),
+                           [](double x, double y) { return GooFit::inDalitz(x, y, D_MASS, d1_MASS, d2_MASS, d3_MASS); });
+    return benchNow() - start;
+}
+
+std::vector<BenchResult> runBenchmarks(size_t maxEvents){
+
+    std::vector<BenchResult> results;
+    auto report = [&](std::string name, std::string params, double value, std::string unit) {
+        GOOFIT_INFO("{:<24} {:<28} {:>14.6g} {}", name, params, value, unit);
+        results.push_back({name, params, value, unit});
+    };
+
+    std::vector<size_t> eventCounts;
+    for(size_t n = 10000; n <= maxEvents; n *= 10)
+        eventCounts.push_back(n);
+    const std::vector<size_t> grids = {250, 500, 1000, 1500, 2000};
+    const std::vector<size_t> knots = {10, 20, 40, 80, 120};
+    const std::vector<std::vector<std::string>> isobarSets
+        = {{}, {"f0_980"}, {"f0_980", "omega", "f2"}, {"f0_980", "omega", "f2", "sigma", "f0_1500", "nonr"}};
+    const size_t fixedEvents = std::min<size_t>(100000, maxEvents);
+
+    const std::string defaultKnots = pwa_file;
+
+    // Event count sweep on the default model and grid
+    for(size_t n : eventCounts) {
+        makeBenchData(n);
+        report("nll_goofit", fmt::format("events={}", n), benchGooFitNLL(1500), "calls/s");
+
+        MIPWALikelihood lik(HH_bin_limits);
+        lik.setEvents(dataColumn(s12), dataColumn(s13));
+        benchEngineNormalization(lik, 1500);
+        report("nll_engine", fmt::format("events={}", n), benchEngineNLL(lik), "calls/s");
+
+        lik.setSinglePrecision(true);
+        lik.setEvents(dataColumn(s12), dataColumn(s13));
+        report("nll_engine_float", fmt::format("events={}", n), benchEngineNLL(lik), "calls/s");
+    }
+
+    // Normalisation grid sweep; with few events the GooFit call is dominated by the integrals
+    makeBenchData(10000);
+    for(size_t g : grids) {
+        report("norm_goofit", fmt::format("grid={}", g), 1 / benchGooFitNLL(g), "s");
+
+        MIPWALikelihood lik(HH_bin_limits);
+        report("norm_engine", fmt::format("grid={}", g), benchEngineNormalization(lik, g), "s");
+    }
+
+    // Spline knot count sweep
+    makeBenchData(fixedEvents);
+    for(size_t k : knots) {
+        pwa_file = makeBenchKnots(defaultKnots, k);
+        report("nll_goofit", fmt::format("knots={}", k), benchGooFitNLL(1500), "calls/s");
+
+        MIPWALikelihood lik(HH_bin_limits);
+        lik.setEvents(dataColumn(s12), dataColumn(s13));
+        benchEngineNormalization(lik, 1500);
+        report("nll_engine", fmt::format("knots={}", k), benchEngineNLL(lik), "calls/s");
+        remove(pwa_file.c_str());
+    }
+    pwa_file = defaultKnots;
+
+    // Isobar set sweep
+    for(const auto &set : isobarSets) {
+        std::string name = "swave";
+        for(const std::string &r : set)
+            name += "+" + r;
+        report("nll_goofit", fmt::format("isobars={}", name), benchGooFitNLL(1500, set), "calls/s");
+    }
+
+    // Toy generator: envelope build and accepted events per second
+    {
+        s12.setNumBins(1500);
+        s13.setNumBins(1500);
+        benchSignalPdf();
+        delete Data;
+        Data = nullptr;
+
+        double start = benchNow();
+        ToyGenerator generator(signaldalitz);
+        report("generator_setup", "grid=1500", benchNow() - start, "s");
+
+        for(size_t n = 10000; n <= std::min<size_t>(maxEvents, 1000000); n *= 10) {
+            std::vector<double> x, y;
+            start = benchNow();
+            generator.generate(n, 1, 0, x, y);
+            report("generator", fmt::format("events={}", n), n / (benchNow() - start), "events/s");
+        }
+    }
+
+    // Template build from a smooth 200x200 source histogram, uncached
+    {
+        bool cacheOn    = templateCacheOn;
+        templateCacheOn = false;
+        TH2F source("bench_template", "", 200, s12.getLowerLimit(), s12.getUpperLimit(), 200, s13.getLowerLimit(),
+                    s13.getUpperLimit());
+        for(int i = 1; i <= 200; i++)
+            for(int j = 1; j <= 200; j++)
+                source.SetBinContent(i, j, 1 + 0.5 * sin(0.1 * i) * cos(0.07 * j));
+
+        for(size_t bins : {120, 1500}) {
+            s12.setNumBins(bins);
+            s13.setNumBins(bins);
+            GooFit::BinnedDataSet binned({s12, s13});
+            double start = benchNow();
+            fillTemplate(&binned, &source, false, 1);
+            report("template", fmt::format("bins={}", bins), benchNow() - start, "s");
+        }
+        templateCacheOn = cacheOn;
+        s12.setNumBins(1500);
+        s13.setNumBins(1500);
+    }
+
+    return results;
+}
+
+// Strong and weak scaling of the NLL over OpenMP thread counts 1, 2, 4, ... and the maximum:
+// strong at strongEvents, weak at weakEvents per thread. The dataset and the engine table are
+// rebuilt for each count so that they are first-touched (and, with --pin, placed) by the
+// team that reads them. Parallel efficiency against one thread goes to the log.
+std::vector<BenchResult> runScaling(size_t strongEvents, size_t weakEvents, const std::string &pin){
+
+    std::vector<BenchResult> results;
+    std::map<std::string, double> single;
+    auto report = [&](std::string name, int threads, size_t events, double rate) {
+        std::string params = fmt::format("threads={} events={}", threads, events);
+        double base        = threads == 1 ? rate : single[name];
+        if(threads == 1)
+            single[name] = rate;
+        // Weak scaling keeps the work per thread, strong scaling the total
+        double efficiency = name.find("weak") != std::string::npos ? rate * threads / base : rate / (base * threads);
+        GOOFIT_INFO("{:<24} {:<28} {:>14.6g} calls/s  efficiency {:.2f}", name, params, rate, efficiency);
+        results.push_back({name, params, rate, "calls/s"});
+    };
+
+#ifdef _OPENMP
+    const int maxThreads = omp_get_max_threads();
+#else
+    const int maxThreads = 1;
+#endif
+    std::vector<int> threadCounts;
+    for(int t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    for(int t : threadCounts) {
+#ifdef _OPENMP
+        omp_set_num_threads(t);
+#endif
+        pinThreads(pin);
+
+        for(bool weak : {false, true}) {
+            size_t n         = weak ? weakEvents * t : strongEvents;
+            std::string kind = weak ? "weak" : "strong";
+            makeBenchData(n);
+            report("scaling_" + kind + "_goofit", t, n, benchGooFitNLL(1500));
+
+            MIPWALikelihood lik(HH_bin_limits);
+            lik.setEvents(dataColumn(s12), dataColumn(s13));
+            benchEngineNormalization(lik, 1500);
+            report("scaling_" + kind + "_engine", t, n, benchEngineNLL(lik));
+        }
+    }
+
+#ifdef _OPENMP
+    omp_set_num_threads(maxThreads);
+#endif
+    return results;
+}
+
+void writeBenchResults(const std::vector<BenchResult> &results, const std::string &fname){
+
+    std::ofstream out(fname.c_str());
+    out << "# benchmark\tparameters\tvalue\tunit\n";
+    for(const BenchResult &r : results)
+        out << r.name << "\t" << r.params << "\t" << std::setprecision(6) << r.value << "\t" << r.unit << '\n';
+}
+
+std::vector<BenchResult> readBenchResults(const std::string &fname){
+
+    std::ifstream in(fname.c_str());
+    if(!in)
+        throw GooFit::GeneralError("Cannot read baseline {}", fname);
+
+    std::vector<BenchResult> results;
+    std::string line;
+    while(std::getline(in, line)) {
+        if(line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        BenchResult r;
+        std::string value;
+        std::getline(fields, r.name, '\t');
+        std::getline(fields, r.params, '\t');
+        std::getline(fields, value, '\t');
+        std::getline(fields, r.unit, '\t');
+        r.value = std::stod(value);
+        results.push_back(r);
+    }
+    return results;
+}
+
+// Prints the change against the baseline; returns the number of regressions beyond tolerance
+size_t compareBenchResults(const std::vector<BenchResult> &results, const std::vector<BenchResult> &baseline,
+                           double tolerance){
+
+    size_t regressions = 0;
+    for(const BenchResult &r : results) {
+        auto base = std::find_if(baseline.begin(), baseline.end(), [&](const BenchResult &b) {
+            return b.name == r.name && b.params == r.params && b.unit == r.unit;
+        });
+        if(base == baseline.end() || base->value <= 0)
+            continue;
+
+        // Positive speedup is an improvement whichever way the unit runs
+        double ratio = r.value / base->value;
+        double speedup = r.higherIsBetter() ? ratio : 1 / ratio;
+        bool regressed = speedup < 1 - tolerance;
+        regressions += regressed;
+        std::cout << fmt::format("{:<24} {:<28} {:>12.6g} -> {:>12.6g} {:<9} x{:.3f}{}", r.name, r.params,
+                                 base->value, r.value, r.unit, speedup, regressed ? "  REGRESSION" : "")
+                  << std::endl;
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv){
+
+    GooFit::Application app{"D2PPP_bench", argc, argv};
+
+    std::string output = "D2PPP_bench.tsv";
+    app.add_option("-o,--output", output, "Benchmark results", true);
+    std::string baseline;
+    app.add_option("--baseline", baseline, "Earlier results to compare with");
+    double tolerance = 0.1;
+    app.add_option("--tolerance", tolerance, "Allowed relative slowdown against the baseline", true);
+    size_t maxEvents = 10000000;
+    app.add_option("--maxEvents", maxEvents, "Largest event count of the sweep", true);
+    app.add_option("--minTime", benchMinTime, "Minimum time per rate measurement [s]", true);
+    bool scaling = false;
+    app.add_flag("--scaling", scaling, "Run the strong/weak thread scaling sweep instead");
+    size_t strongEvents = 1000000;
+    app.add_option("--strongEvents", strongEvents, "Events of the strong scaling sweep", true);
+    size_t weakEvents = 100000;
+    app.add_option("--weakEvents", weakEvents, "Events per thread of the weak scaling sweep", true);
+    std::string pin = "none";
+    app.add_option("--pin", pin, "OpenMP thread placement: none, compact or scatter", true);
+
+    GOOFIT_PARSE(app);
+
+    pinThreads(pin);
+
+    auto results = scaling ? runScaling(strongEvents, weakEvents, pin) : runBenchmarks(maxEvents);
+    writeBenchResults(results, output);
+
+    if(!baseline.empty()) {
+        size_t regressions = compareBenchResults(results, readBenchResults(baseline), tolerance);
+        if(regressions > 0) {
+            GOOFIT_WARN("{} benchmark(s) slower than the baseline by more than {}%", regressions, 100 * tolerance);
+            return 1;
+        }
+    }
+
+    return 0;
+}
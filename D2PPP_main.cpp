@@ -0,0 +1,207 @@
+// The D2PPP program: command line and subcommands. The analysis itself is in D2PPP.cpp.
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <vector>
+
+#ifdef D2PPP_MPI
+#include <mpi.h>
+#endif
+
+#include <CLI/Timer.hpp>
+#include <goofit/Application.h>
+
+#include "FitTrace.h"
+#include "D2PPP.h"
+
+int main(int argc, char **argv){
+
+#ifdef D2PPP_MPI
+    // GooFit's own MPI build may have started MPI already
+    struct MPISession {
+        MPISession(int *argc, char ***argv) {
+            int on;
+            MPI_Initialized(&on);
+            if(!on)
+                MPI_Init(argc, argv);
+
+            // An uncaught exception on one rank (e.g. a bad checkpoint on rank 0 while the
+            // others serve its likelihood) would leave the rest blocked in a collective
+            std::set_terminate([] {
+                if(std::exception_ptr e = std::current_exception()) {
+                    try {
+                        std::rethrow_exception(e);
+                    } catch(const std::exception &x) {
+                        fprintf(stderr, "D2PPP rank %d: %s\n", mpiRank(), x.what());
+                    } catch(...) {
+                    }
+                }
+                MPI_Abort(MPI_COMM_WORLD, 1);
+                std::abort();
+            });
+        }
+        ~MPISession() {
+            int off;
+            MPI_Finalized(&off);
+            if(!off)
+                MPI_Finalize();
+        }
+    } mpi(&argc, &argv);
+#endif
+
+    GooFit::Application app{"D2PPP",argc,argv};
+
+    app.add_flag("--bkgOn", bkgOn, "Turn on background (requires file)");
+    app.add_flag("--toyOn", toyOn, "Fit/plot the toy file instead of the data tree");
+    app.add_flag("--symmetric", symmetricOn, "With fit --quadNorm: integrate only the s12 <= s13 half of the Bose-symmetric Dalitz plot");
+
+    std::string toyname = "D2PPP_toy.bin";
+    app.add_option("--toyFile", toyname, "Toy event file (binary; text files are still read)", true);
+
+    app.add_option("--firstEntry", data_selection.firstEntry, "First data tree entry to read", true);
+    app.add_option("--nEntries", data_selection.nEntries, "Number of data tree entries to scan (-1: all)", true);
+    app.add_option("--cut", data_selection.cut, "Selection applied to the data tree");
+    app.add_option("--maxEvents", data_selection.maxEvents, "Maximum number of selected data events (-1: all)", true);
+    app.add_option("--readThreads", data_selection.threads, "Threads for reading the data tree (0: all cores)", true);
+    app.add_option("--weight", weight_branch, "Per-event weight branch of the data tree, e.g. sWeights (fit --quadNorm only)");
+
+    std::string pinMode = "none";
+    app.add_option("--pin", pinMode, "OpenMP thread placement: none, compact (socket by socket) or scatter (alternate sockets)", true);
+
+    std::string traceName;
+    app.add_option("--trace", traceName, "Write <name>.json (timing/memory summary) and <name>.trace.json (Chrome trace)");
+
+    bool noTemplateCache = false;
+    app.add_option("--templateCache", template_cache_dir, "Directory for cached efficiency/background templates", true);
+    app.add_flag("--noTemplateCache", noTemplateCache, "Always rebuild the efficiency/background templates");
+
+    size_t  nevents = 100000;
+
+    auto gen = app.add_subcommand("gen","generate toy data");
+    gen->add_option("-e,--events",nevents,"The number of events to generate",true);
+    std::string textname;
+    gen->add_option("--text",textname,"Also export the toy as a text file");
+    uint32_t seed = 0;
+    gen->add_option("--seed",seed,"Seed of the toy generator",true);
+
+    auto toyfit = app.add_subcommand("fit","fit toy data/toyMC");
+    bool quadNorm = false;
+    toyfit->add_flag("--quadNorm",quadNorm,"Signal-only MIPWA fit with a precomputed quadratic-form normalisation");
+    toyfit->add_option("--checkpoint",fit_checkpointing.file,"Binary Minuit2 checkpoint written during the fit (default: none)");
+    toyfit->add_option("--checkpointCalls",fit_checkpointing.calls,"FCN calls between checkpoints (0: only at the end)",true);
+    toyfit->add_flag("--resume",fit_checkpointing.resume,"Continue from the --checkpoint file if it exists");
+    toyfit->add_option("--warm-start",fit_checkpointing.warmStart,"Start from the minimum and covariance of this checkpoint");
+    toyfit->add_option("--starts",multi_start.starts,"With --quadNorm: number of concurrent fits from scattered starting points",true);
+    toyfit->add_flag("--randomStarts",multi_start.random,"Uniform instead of Latin-hypercube starting points");
+    toyfit->add_option("--startSpread",multi_start.spread,"Half-width of the start box, as a fraction of each limit range",true);
+    toyfit->add_option("--killDelta",multi_start.killDelta,"NLL gap beyond which a stalling start is dropped",true);
+    toyfit->add_option("--startSeed",multi_start.seed,"Seed of the starting points",true);
+    toyfit->add_option("--startsOutput",multi_start.output,"Ranked minima of the multi-start fit",true);
+    double normTol = 0;
+    toyfit->add_option("--normTol",normTol,"With --quadNorm: refine the normalisation adaptively to this relative accuracy (0: fixed grid)",true);
+    std::vector<std::string> fitIsobars;
+    toyfit->add_option("--isobars",fitIsobars,"Isobar waves added to the S-wave: omega, f2, sigma, f0_1500, f0_980, nonr");
+    toyfit->add_flag("--singlePrecision",fit_precision.single,"With --quadNorm: single-precision basis table, double sums");
+    toyfit->add_option("--validatePrecision",fit_precision.validate,"With --quadNorm: refit in the other precision and write the comparison here");
+    size_t fitBins = 0;
+    toyfit->add_option("--binned",fitBins,"With --quadNorm: binned extended-likelihood fit on this many bins per axis (0: unbinned)",true);
+
+    auto plot = app.add_subcommand("plot","plot signal");
+
+    size_t ntoys = 10;
+    size_t nstudyevents = 100000;
+    std::string studyname = "D2PPP_study.txt";
+    auto study = app.add_subcommand("study","generate and fit toys in one job, with pulls");
+    study->add_option("-n,--toys",ntoys,"The number of toys",true);
+    study->add_option("-e,--events",nstudyevents,"The number of events per toy",true);
+    study->add_option("-o,--output",studyname,"Output table of fitted values, errors and pulls",true);
+    study->add_option("--seed",seed,"Seed of the toy generator (toy k uses stream k)",true);
+
+    std::string compareReference = "Parametros_iniciais.txt";
+    std::vector<std::string> compareFits = {"Parametros_fit.txt"};
+    std::string compareOutput = "D2PPP_compare.txt";
+    std::vector<std::string> compareToys;
+    std::string compareCoefs = pwa_file;
+    auto compare = app.add_subcommand("compare","compare fitted S-wave coefficients with a reference, over any number of fits");
+    compare->add_option("-r,--reference",compareReference,"Reference coefficients (the last fit in the file is used)",true);
+    compare->add_option("-f,--fits",compareFits,"Fit outputs: saveParameters() files (appended fits included) or study tables",true);
+    compare->add_option("-o,--output",compareOutput,"Per-knot table of shifts and pulls",true);
+    compare->add_option("--toys",compareToys,"Two toy files whose s12 distributions are compared");
+    compare->add_option("--coefs",compareCoefs,"PWA knots to draw (empty: none)",true);
+
+
+    GOOFIT_PARSE(app);
+
+    pinThreads(pinMode);
+
+    templateCacheOn = !noTemplateCache;
+    if(symmetricOn && (s12_min != s13_min || s12_max != s13_max))
+        throw GooFit::GeneralError("--symmetric needs identical s12 and s13 ranges");
+    if(symmetricOn && (!*toyfit || !quadNorm || *gen || *plot || *study || *compare))
+        throw GooFit::GeneralError("--symmetric needs fit --quadNorm: the GooFit PDFs integrate the whole Dalitz plot");
+    FitTrace::instance().enable(!traceName.empty());
+
+    /// Make the plot directory if it does not exist
+    std::string command = "mkdir -p plots";
+    if(system(command.c_str()) != 0)
+        throw GooFit::GeneralError("Making `plots` directory failed");
+
+    if(mpiSize() > 1 && (!*toyfit || !quadNorm || *gen || *plot || *study || *compare))
+        throw GooFit::GeneralError("Only fit --quadNorm is distributed over MPI processes; build GooFit with "
+                                   "GOOFIT_MPI to split the events of its fits");
+
+    if(*gen){
+        CLI::AutoTimer timer("MC Generation");
+        runtoygen(toyname,nevents,textname,seed);
+    }
+
+    if(*toyfit){
+        CLI::AutoTimer timer("FIT");
+        if(mpiSize() > 1 && (multi_start.starts > 0 || !fit_precision.validate.empty()))
+            throw GooFit::GeneralError("--starts and --validatePrecision run on a single process");
+        if(fit_checkpointing.resume && fit_checkpointing.file.empty())
+            throw GooFit::GeneralError("--resume needs the --checkpoint file to continue from");
+        if(multi_start.starts > 0 && !quadNorm)
+            throw GooFit::GeneralError("--starts needs --quadNorm: GooFit keeps one set of device-side PDF tables");
+        if(!weight_branch.empty() && !quadNorm)
+            throw GooFit::GeneralError("--weight needs --quadNorm: the GooFit NLL has no per-event weights");
+        if(!fitIsobars.empty() && quadNorm)
+            throw GooFit::GeneralError("--isobars needs the GooFit fit: the host likelihood has the S-wave only");
+        if((fit_precision.single || !fit_precision.validate.empty()) && !quadNorm)
+            throw GooFit::GeneralError("--singlePrecision needs --quadNorm: GooFit's fptype is fixed when it is built");
+        if(fitBins > 0 && !quadNorm)
+            throw GooFit::GeneralError("--binned needs --quadNorm: DalitzPlotPdf caches its waves per event");
+        if(normTol > 0 && !quadNorm)
+            throw GooFit::GeneralError("--normTol needs --quadNorm: DalitzPlotPdf integrates on the fixed s12 x s13 grid");
+        if(quadNorm)
+            runquadnormfit(toyname,normTol,fitBins);
+        else
+            runtoyfit(toyname,fitIsobars);
+    }
+
+    
+    if(*plot){
+        CLI::AutoTimer timer("FIT");
+        runMakeToyDalitzPdfPlots(toyname);
+    }
+
+    if(*study){
+        CLI::AutoTimer timer("STUDY");
+        runtoystudy(ntoys,nstudyevents,studyname,seed);
+    }
+
+    if(*compare){
+        CLI::AutoTimer timer("COMPARE");
+        runcompare(compareReference,compareFits,compareOutput,compareToys,compareCoefs);
+    }
+
+    if(!traceName.empty()) {
+        if(mpiSize() > 1)
+            traceName += ".rank" + std::to_string(mpiRank());
+        FitTrace::instance().writeSummary(traceName + ".json");
+        FitTrace::instance().writeChromeTrace(traceName + ".trace.json");
+    }
+
+}
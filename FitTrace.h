@@ -0,0 +1,185 @@
+#pragma once
+
+// Instrumentation of the fit path: timed phases (nested scopes such as "nll/events") and
+// tracked memory (current and peak bytes per label). Off by default; when off a scope is a
+// flag check. The recorded phases are written as a JSON summary and as a Chrome trace
+// (chrome://tracing, Perfetto) timeline.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+class FitTrace {
+  public:
+    static FitTrace &instance() {
+        static FitTrace trace;
+        return trace;
+    }
+
+    void enable(bool on = true) { enabled_ = on; }
+    bool enabled() const { return enabled_; }
+
+    // Times the enclosing block as phase `name`
+    class Scope {
+      public:
+        explicit Scope(const char *name)
+            : name_(FitTrace::instance().enabled() ? name : nullptr) {
+            if(name_)
+                begin_ = FitTrace::instance().now();
+        }
+
+        ~Scope() {
+            if(name_)
+                FitTrace::instance().record(name_, begin_, FitTrace::instance().now());
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+      private:
+        const char *name_;
+        double begin_ = 0;
+    };
+
+    // Sets the bytes held under `label`; the peak is kept
+    void memory(const std::string &label, size_t bytes) {
+        if(!enabled_)
+            return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        Memory &m = memory_[label];
+        m.current = bytes;
+        m.peak    = std::max(m.peak, bytes);
+        counters_.push_back({label, now(), bytes});
+    }
+
+    // Adds `value` to the counter `name` (e.g. events processed)
+    void count(const std::string &name, double value = 1) {
+        if(!enabled_)
+            return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        totals_[name] += value;
+    }
+
+    void writeSummary(const std::string &fname) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        FILE *out = fopen(fname.c_str(), "w");
+        if(!out)
+            return;
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        fprintf(out, "{\n  \"wall_s\": %.6f,\n  \"peak_rss_bytes\": %ld,\n  \"phases\": {", now() * 1e-6,
+                usage.ru_maxrss * 1024L);
+        const char *sep = "";
+        for(const auto &p : phases_) {
+            const Phase &s = p.second;
+            fprintf(out,
+                    "%s\n    \"%s\": {\"count\": %zu, \"total_s\": %.6f, \"mean_s\": %.9f, \"min_s\": %.9f, "
+                    "\"max_s\": %.9f}",
+                    sep, p.first.c_str(), s.count, s.total * 1e-6, s.total * 1e-6 / s.count, s.min * 1e-6,
+                    s.max * 1e-6);
+            sep = ",";
+        }
+        fprintf(out, "\n  },\n  \"memory\": {");
+        sep = "";
+        for(const auto &m : memory_) {
+            fprintf(out, "%s\n    \"%s\": {\"current_bytes\": %zu, \"peak_bytes\": %zu}", sep, m.first.c_str(),
+                    m.second.current, m.second.peak);
+            sep = ",";
+        }
+        fprintf(out, "\n  },\n  \"counters\": {");
+        sep = "";
+        for(const auto &t : totals_) {
+            fprintf(out, "%s\n    \"%s\": %.17g", sep, t.first.c_str(), t.second);
+            sep = ",";
+        }
+        fprintf(out, "\n  }\n}\n");
+        fclose(out);
+    }
+
+    void writeChromeTrace(const std::string &fname) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        FILE *out = fopen(fname.c_str(), "w");
+        if(!out)
+            return;
+
+        fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+        const char *sep = "\n";
+        for(const Event &e : events_) {
+            fprintf(out,
+                    "%s{\"name\": \"%s\", \"cat\": \"fit\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, "
+                    "\"tid\": %u}",
+                    sep, e.name, e.begin, e.end - e.begin, e.thread);
+            sep = ",\n";
+        }
+        for(const Counter &c : counters_) {
+            fprintf(out, "%s{\"name\": \"memory\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"args\": {\"%s\": %zu}}",
+                    sep, c.time, c.label.c_str(), c.bytes);
+            sep = ",\n";
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+    }
+
+  private:
+    struct Event {
+        const char *name;
+        double begin, end;
+        unsigned thread;
+    };
+
+    struct Phase {
+        size_t count = 0;
+        double total = 0, min = 0, max = 0;
+    };
+
+    struct Memory {
+        size_t current = 0, peak = 0;
+    };
+
+    struct Counter {
+        std::string label;
+        double time;
+        size_t bytes;
+    };
+
+    FitTrace()
+        : start_(std::chrono::steady_clock::now()) {}
+
+    // Microseconds since the trace was created
+    double now() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+    void record(const char *name, double begin, double end) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto id = threads_.emplace(std::this_thread::get_id(), threads_.size()).first->second;
+        events_.push_back({name, begin, end, id});
+
+        Phase &p = phases_[name];
+        double d = end - begin;
+        p.min    = p.count ? std::min(p.min, d) : d;
+        p.max    = std::max(p.max, d);
+        p.total += d;
+        p.count++;
+    }
+
+    bool enabled_ = false;
+    std::chrono::steady_clock::time_point start_;
+    mutable std::mutex mutex_;
+    std::vector<Event> events_;
+    std::vector<Counter> counters_;
+    std::map<std::string, Phase> phases_;
+    std::map<std::string, Memory> memory_;
+    std::map<std::string, double> totals_;
+    std::map<std::thread::id, unsigned> threads_;
+};
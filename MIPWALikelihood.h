@@ -0,0 +1,1086 @@
+#pragma once
+
+// Host-side likelihood for the MIPWA S-wave fit. The Spline resonance is linear in its knot
+// coefficients, so |A|^2 integrated over the phase space is a fixed quadratic form in them:
+// the overlap matrix of the spline basis is built once and each normalisation afterwards
+// costs O(n_knots^2) instead of a pass over the integration grid.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "FitTrace.h"
+
+// Allocator whose default construction leaves the value uninitialised, so that resize() does
+// not touch the pages; the parallel loop that first writes them then places each page on the
+// NUMA node of the thread that will read it in the event loops.
+template <typename T>
+struct FirstTouchAllocator : std::allocator<T> {
+    template <typename U>
+    struct rebind {
+        using other = FirstTouchAllocator<U>;
+    };
+
+    FirstTouchAllocator() = default;
+    template <typename U>
+    FirstTouchAllocator(const FirstTouchAllocator<U> &) {}
+
+    template <typename U>
+    void construct(U *p) noexcept(std::is_nothrow_default_constructible<U>::value) {
+        ::new(static_cast<void *>(p)) U;
+    }
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&... args) {
+        ::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T>
+using TableVector = std::vector<T, FirstTouchAllocator<T>>;
+
+// Combines partial results of MIPWALikelihood across processes. Each process holds a
+// contiguous range of whole blocks of the global list. The one-off sums of setEvents() and
+// buildNormalization() gather() all blocks and sum them in the same order, so they do not
+// depend on the process count; nll() and scoreCovariance() run at every Minuit step and take
+// one sum() of this process's ordered partial sums instead.
+class BlockExchange {
+  public:
+    virtual ~BlockExchange() = default;
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+
+    // data holds nBlocks x width values; blocks [first, first + count) were filled by this
+    // process, and on return all blocks are filled
+    virtual void gather(double *data, size_t nBlocks, size_t width, size_t first, size_t count) const = 0;
+
+    // Element-wise sum of data over the processes
+    virtual void sum(double *data, size_t n) const = 0;
+};
+
+// Natural cubic spline on fixed knots, as evaluated by Resonances::Spline: second derivatives
+// from the Numerical Recipes natural spline, and zero outside [x_0, x_{n-1}).
+class SplineBasis {
+  public:
+    explicit SplineBasis(const std::vector<double> &knots)
+        : x_(knots)
+        , d_(knots.size() * knots.size()) {
+        size_t n = x_.size();
+        std::vector<double> unit(n), y2(n);
+
+        // y2 is linear in the knot values: y2 = D y, built one column at a time
+        for(size_t j = 0; j < n; j++) {
+            std::fill(unit.begin(), unit.end(), 0.0);
+            unit[j] = 1;
+            secondDerivatives(unit.data(), y2.data());
+            for(size_t i = 0; i < n; i++)
+                d_[i * n + j] = y2[i];
+        }
+    }
+
+    size_t size() const { return x_.size(); }
+
+    const std::vector<double> &knots() const { return x_; }
+
+    // Row-major n x n matrix with y2 = D y
+    const std::vector<double> &derivativeMatrix() const { return d_; }
+
+    void secondDerivatives(const double *y, double *y2) const {
+        size_t n = x_.size();
+        std::vector<double> u(n, 0.0);
+
+        y2[0] = 0;
+        for(size_t i = 1; i + 1 < n; i++) {
+            double sig = (x_[i] - x_[i - 1]) / (x_[i + 1] - x_[i - 1]);
+            double p   = sig * y2[i - 1] + 2.0;
+            y2[i]      = (sig - 1.0) / p;
+            u[i]       = (y[i + 1] - y[i]) / (x_[i + 1] - x_[i]) - (y[i] - y[i - 1]) / (x_[i] - x_[i - 1]);
+            u[i]       = (6.0 * u[i] / (x_[i + 1] - x_[i - 1]) - sig * u[i - 1]) / p;
+        }
+        y2[n - 1] = 0;
+        for(size_t k = n - 1; k-- > 0;)
+            y2[k] = y2[k] * y2[k + 1] + u[k];
+    }
+
+    // Interval [x_lo, x_lo+1) containing s; false outside the knot range
+    bool locate(double s, size_t &lo) const {
+        size_t hi = std::upper_bound(x_.begin(), x_.end(), s) - x_.begin();
+        if(hi == 0 || hi == x_.size())
+            return false;
+        lo = hi - 1;
+        return true;
+    }
+
+    // Weights of y[lo], y[lo+1], y2[lo], y2[lo+1] in the spline value at s
+    void localWeights(double s, size_t lo, double w[4]) const {
+        double h  = x_[lo + 1] - x_[lo];
+        double aa = (x_[lo + 1] - s) / h;
+        double bb = 1 - aa;
+        w[0]      = aa;
+        w[1]      = bb;
+        w[2]      = (aa * aa * aa - aa) * h * h / 6.0;
+        w[3]      = (bb * bb * bb - bb) * h * h / 6.0;
+    }
+
+  private:
+    std::vector<double> x_;
+    std::vector<double> d_;
+};
+
+// Unbinned NLL of the symmetrised MIPWA amplitude A = S(s12) + S(s13), up to a constant.
+// Parameters are the real and imaginary knot values. The overall complex coupling of the
+// wave cancels between |A|^2 and the normalisation, so it does not enter.
+class MIPWALikelihood {
+  public:
+    explicit MIPWALikelihood(const std::vector<double> &knots)
+        : basis_(knots) {}
+
+    size_t numKnots() const { return basis_.size(); }
+
+    const SplineBasis &basis() const { return basis_; }
+
+    // Distributed mode: this process holds events [firstEvent, firstEvent + numEvents()) of
+    // totalEvents, with firstEvent a multiple of eventBlockSize(). The event sums, the sum of
+    // weights and the fixed-grid normalisation are combined through the exchange (which must
+    // outlive the likelihood). The sum of weights and the normalisation come out identical to
+    // a single-process run; nll() adds one allreduce of 1 + 4n values per call, so it agrees
+    // with one process to rounding. The binned and adaptive builders run in full on every
+    // process. Call before setEvents().
+    void setPartition(const BlockExchange *exchange, size_t firstEvent, size_t totalEvents) {
+        exchange_    = exchange;
+        firstEvent_  = firstEvent;
+        totalEvents_ = totalEvents;
+    }
+
+    static size_t eventBlockSize() { return blockSize; }
+
+    // Precomputes the per-event basis table. Event masses do not change during a fit, so each
+    // event's amplitude is a fixed row of basis weights dotted with the coefficient vector.
+    // The row is stored in factored form: the interval of each mass and the 8 weights on the
+    // (y, y2) values at its ends, in structure-of-arrays layout for vectorisation.
+    // With per-event weights (e.g. sWeights) each event's log-likelihood term is scaled by its
+    // weight and the normalisation by the sum of weights; see scoreCovariance() for the errors.
+    void setEvents(const std::vector<double> &s12, const std::vector<double> &s13,
+                   const std::vector<double> &weights = {}) {
+        buildTable(s12, s13);
+        binFirst_.clear();
+        binCount_.clear();
+        pointWeight_.clear();
+
+        eventWeight_ = TableVector<double>(weights.size());
+        forEachBlock(weights.size(), [&](size_t begin, size_t end) {
+            std::copy(weights.begin() + begin, weights.begin() + end, eventWeight_.begin() + begin);
+        });
+
+        // The sum of weights goes by global blocks like the NLL
+        weightSum_ = exchange_ ? totalEvents_ : nEvents_;
+        if(!eventWeight_.empty()) {
+            std::vector<double> partial(globalBlocks(), 0.0);
+            const size_t first = firstEvent_ / blockSize;
+            forEachBlock(nEvents_, [&](size_t begin, size_t end) {
+                double sum = 0;
+                for(size_t e = begin; e < end; e++)
+                    sum += eventWeight_[e];
+                partial[first + begin / blockSize] = sum;
+            });
+            if(exchange_)
+                exchange_->gather(partial.data(), partial.size(), 1, first, localBlocks());
+            weightSum_ = compensatedSum(partial);
+        }
+    }
+
+    size_t numEvents() const { return nEvents_; }
+
+    bool weighted() const { return !eventWeight_.empty(); }
+
+    // Bose-symmetric mode. A(s12, s13) = A(s13, s12), so the phase-space integrals only need
+    // the s12 <= s13 half: off-diagonal cells count twice, cells on the diagonal once. Applies
+    // to the normalisation builders and to setBinnedEvents(), and needs a square grid with
+    // the same limits on both axes; other grids are integrated in full.
+    void setSymmetric(bool on) { symmetric_ = on; }
+
+    bool symmetric() const { return symmetric_; }
+
+    // Mixed precision: the basis table (and the binned-mode rule points) is stored in single
+    // precision, halving its memory and bandwidth, while amplitudes, logs and all sums stay in
+    // double and the block partials are combined with compensated summation. Takes effect at
+    // the next setEvents()/setBinnedEvents().
+    void setSinglePrecision(bool on) { single_ = on; }
+
+    bool singlePrecision() const { return single_; }
+
+    double sumOfWeights() const { return weightSum_; }
+
+    // Binned mode: the events are histogrammed on an nx x ny grid, and the likelihood becomes
+    // -sum_b n_b log I_b + N log sum_b I_b, the multinomial (yield-profiled extended Poisson)
+    // likelihood of the bin counts, with I_b the integral of |A|^2 over bin b. Each bin is
+    // integrated with the 3x3 Gauss-Legendre rule on its part inside the phase space (on each
+    // quadrant for bins the boundary cuts); the rule points go through the basis table in
+    // place of the events, so a call costs O(bins) whatever the sample size. Returns the
+    // number of events dropped because their bin has no rule point inside.
+    size_t setBinnedEvents(const std::vector<double> &s12, const std::vector<double> &s13, size_t nx, double x0,
+                           double x1, size_t ny, double y0, double y1,
+                           const std::function<bool(double, double)> &inside) {
+        const double dx  = (x1 - x0) / nx;
+        const double dy  = (y1 - y0) / ny;
+        const bool folds = folded(nx, x0, x1, ny, y0, y1);
+
+        // Folded, each event is counted at (min, max) and only bins with j >= i are kept; a
+        // diagonal bin's half is integrated as half of the whole bin
+        std::vector<double> counts(nx * ny, 0.0);
+        for(size_t e = 0; e < s12.size(); e++) {
+            double a = s12[e], b = s13[e];
+            if(folds && a > b)
+                std::swap(a, b);
+            long i = std::floor((a - x0) / dx);
+            long j = std::floor((b - y0) / dy);
+            if(i >= 0 && i < (long)nx && j >= 0 && j < (long)ny)
+                counts[i * ny + j]++;
+        }
+        if(exchange_)
+            exchange_->sum(counts.data(), counts.size());
+
+        std::vector<double> px, py;
+        pointWeight_.clear();
+        binFirst_.assign(1, 0);
+        binCount_.clear();
+        size_t dropped = 0;
+        for(size_t i = 0; i < nx; i++)
+            for(size_t j = folds ? i : 0; j < ny; j++) {
+                double bx0 = x0 + dx * i, bx1 = bx0 + dx;
+                double by0 = y0 + dy * j, by1 = by0 + dy;
+                bool cut   = !(inside(bx0, by0) && inside(bx1, by0) && inside(bx0, by1) && inside(bx1, by1));
+                double scale  = folds && i == j ? 0.5 : 1.0;
+                size_t before = px.size();
+                auto add      = [&](double x, double y, double w) {
+                    px.push_back(x);
+                    py.push_back(y);
+                    pointWeight_.push_back(scale * w);
+                };
+                if(cut) {
+                    double bxm = 0.5 * (bx0 + bx1), bym = 0.5 * (by0 + by1);
+                    forEachRuleNode(bx0, bxm, by0, bym, inside, add);
+                    forEachRuleNode(bxm, bx1, by0, bym, inside, add);
+                    forEachRuleNode(bx0, bxm, bym, by1, inside, add);
+                    forEachRuleNode(bxm, bx1, bym, by1, inside, add);
+                } else
+                    forEachRuleNode(bx0, bx1, by0, by1, inside, add);
+
+                if(px.size() == before) {
+                    dropped += counts[i * ny + j];
+                    continue;
+                }
+                binFirst_.push_back(px.size());
+                binCount_.push_back(counts[i * ny + j]);
+            }
+
+        buildTable(px, py);
+        eventWeight_.clear();
+        binTotal_ = 0;
+        for(double c : binCount_)
+            binTotal_ += c;
+        weightSum_ = binTotal_;
+        return dropped;
+    }
+
+    bool binned() const { return !binCount_.empty(); }
+
+    size_t numBins() const { return binCount_.size(); }
+
+    // Overlap matrix M = sum_p b_p b_p^T over the centres of an nx x ny grid that pass inside(),
+    // with b_p the basis row at p, so that the normalisation is r^T M r + m^T M m.
+    // Each point only touches 8 of the 2n local (y, y2) weights, so the points are accumulated
+    // in that space and mapped to knot space once at the end with B = [1; D].
+    void buildNormalization(size_t nx, double x0, double x1, size_t ny, double y0, double y1,
+                            const std::function<bool(double, double)> &inside) {
+        FitTrace::Scope scope("normalisation matrix");
+        const size_t n  = numKnots();
+        const size_t n2 = 2 * n;
+        const double dx  = (x1 - x0) / nx;
+        const double dy  = (y1 - y0) / ny;
+        const bool folds = folded(nx, x0, x1, ny, y0, y1);
+
+        // Fixed chunks summed in order keep the result independent of the thread count; in
+        // distributed mode each process builds an even share of the chunks
+        const size_t nChunks = std::min<size_t>(64, nx);
+        std::vector<double> chunks(nChunks * n2 * n2, 0.0);
+        const int rank = exchange_ ? exchange_->rank() : 0, size = exchange_ ? exchange_->size() : 1;
+        const size_t firstChunk = nChunks * rank / size, lastChunk = nChunks * (rank + 1) / size;
+
+#pragma omp parallel for schedule(dynamic)
+        for(long c = firstChunk; c < (long)lastChunk; c++) {
+            double *g = &chunks[c * n2 * n2];
+            size_t idx[8];
+            double w[8];
+
+            for(size_t i = c * nx / nChunks; i < (c + 1) * nx / nChunks; i++) {
+                double x = x0 + (i + 0.5) * dx;
+                for(size_t j = folds ? i : 0; j < ny; j++) {
+                    double y = y0 + (j + 0.5) * dy;
+                    if(!inside(x, y) || !pointWeights(x, y, idx, w))
+                        continue;
+                    double m = folds && j != i ? 2.0 : 1.0;
+                    for(int a = 0; a < 8; a++)
+                        for(int b = 0; b < 8; b++)
+                            g[idx[a] * n2 + idx[b]] += m * w[a] * w[b];
+                }
+            }
+        }
+        if(exchange_)
+            exchange_->gather(chunks.data(), nChunks, n2 * n2, firstChunk, lastChunk - firstChunk);
+
+        setNormalization(mergeChunks(chunks, nChunks));
+    }
+
+    // Adaptive alternative to buildNormalization() with an accuracy target instead of a bin
+    // count. Cells covering the phase space are integrated with a 3x3 Gauss-Legendre rule on
+    // each quadrant; the difference to the same rule on the whole cell is the error estimate.
+    // The cells with the largest errors in the integral of |A|^2 for the given coefficients are
+    // split until the total error is below tolerance times the integral, so points go where
+    // the amplitude varies fastest (narrow structures, thresholds, the boundary) and none are
+    // spent outside the kinematic region. Returns the number of amplitude evaluations.
+    size_t buildNormalizationAdaptive(double x0, double x1, double y0, double y1,
+                                      const std::function<bool(double, double)> &inside, const double *re,
+                                      const double *im, double tolerance, size_t maxCells = 1 << 20) {
+        FitTrace::Scope scope("normalisation matrix");
+        const size_t n  = numKnots();
+        const size_t n2 = 2 * n;
+        std::vector<double> cr(n2), ci(n2);
+        std::copy(re, re + n, cr.begin());
+        std::copy(im, im + n, ci.begin());
+        basis_.secondDerivatives(re, cr.data() + n);
+        basis_.secondDerivatives(im, ci.data() + n);
+
+        // Folded, only cells on or above the diagonal are kept; diagonal cells stay symmetric
+        // under splitting, and their quadrant below the diagonal is dropped
+        const size_t nInit = 64;
+        const bool folds   = folded(nInit, x0, x1, nInit, y0, y1);
+        std::vector<Cell> cells;
+        for(size_t i = 0; i < nInit; i++)
+            for(size_t j = folds ? i : 0; j < nInit; j++) {
+                Cell c;
+                c.x0       = x0 + (x1 - x0) * i / nInit;
+                c.x1       = x0 + (x1 - x0) * (i + 1) / nInit;
+                c.y0       = y0 + (y1 - y0) * j / nInit;
+                c.y1       = y0 + (y1 - y0) * (j + 1) / nInit;
+                c.diagonal = folds && i == j;
+                c.weight   = folds && i != j ? 2 : 1;
+                cells.push_back(c);
+            }
+
+        size_t evaluations = 0;
+        auto evaluate      = [&](const std::vector<size_t> &which) {
+#pragma omp parallel for schedule(dynamic, 16)
+            for(long k = 0; k < (long)which.size(); k++)
+                evaluateCell(cells[which[k]], inside, cr.data(), ci.data());
+            evaluations += which.size() * 45;
+        };
+
+        std::vector<size_t> all(cells.size());
+        for(size_t k = 0; k < all.size(); k++)
+            all[k] = k;
+        evaluate(all);
+
+        // Cells with no point inside the phase space are dropped
+        cells.erase(std::remove_if(cells.begin(), cells.end(), [](const Cell &c) { return !c.touches; }), cells.end());
+
+        while(cells.size() < maxCells) {
+            double total = 0, area = 0;
+            for(const Cell &c : cells) {
+                total += c.weight * c.value;
+                area += c.value > 0 ? c.weight * c.area() : 0;
+            }
+
+            // Straddling cells are charged their area at the mean density
+            std::vector<double> errors(cells.size());
+            double error = 0;
+            for(size_t k = 0; k < cells.size(); k++) {
+                errors[k] = cells[k].weight
+                            * (cells[k].straddles && area > 0 ? cells[k].area() * total / area : cells[k].error);
+                error += errors[k];
+            }
+            if(error <= tolerance * total)
+                break;
+
+            // Split the worst eighth of the cells at a time; ties broken by position so the
+            // grid is the same whatever the thread count
+            std::vector<size_t> order(cells.size());
+            for(size_t k = 0; k < order.size(); k++)
+                order[k] = k;
+            size_t nSplit = std::max<size_t>(1, std::min(cells.size() / 8, (maxCells - cells.size()) / 3));
+            std::partial_sort(order.begin(), order.begin() + nSplit, order.end(), [&](size_t a, size_t b) {
+                return errors[a] > errors[b] || (errors[a] == errors[b] && a < b);
+            });
+
+            std::vector<size_t> changed(order.begin(), order.begin() + nSplit);
+            for(size_t k = 0; k < nSplit; k++) {
+                Cell parent = cells[order[k]];
+                double xm   = 0.5 * (parent.x0 + parent.x1);
+                double ym   = 0.5 * (parent.y0 + parent.y1);
+                Cell quad[4] = {parent, parent, parent, parent};
+                quad[0].x1 = quad[2].x1 = xm;
+                quad[1].x0 = quad[3].x0 = xm;
+                quad[0].y1 = quad[1].y1 = ym;
+                quad[2].y0 = quad[3].y0 = ym;
+                if(parent.diagonal) {
+                    quad[2].diagonal = false;
+                    quad[2].weight   = 2;
+                }
+                cells[order[k]] = quad[0];
+                for(int q = 1; q < 4; q++) {
+                    if(parent.diagonal && q == 1)
+                        continue;
+                    changed.push_back(cells.size());
+                    cells.push_back(quad[q]);
+                }
+            }
+            evaluate(changed);
+        }
+
+        // Accumulate the basis overlaps on the final cells, in fixed chunks as above
+        const size_t nChunks = std::min<size_t>(64, cells.size());
+        std::vector<double> chunks(nChunks * n2 * n2, 0.0);
+
+#pragma omp parallel for schedule(dynamic)
+        for(long c = 0; c < (long)nChunks; c++) {
+            double *g = &chunks[c * n2 * n2];
+            bool touches;
+            for(size_t k = c * cells.size() / nChunks; k < (c + 1) * cells.size() / nChunks; k++)
+                forEachPoint(
+                    cells[k],
+                    inside,
+                    [&](const size_t idx[8], const double w[8], double weight) {
+                        weight *= cells[k].weight;
+                        for(int a = 0; a < 8; a++)
+                            for(int b = 0; b < 8; b++)
+                                g[idx[a] * n2 + idx[b]] += weight * w[a] * w[b];
+                    },
+                    touches);
+        }
+
+        setNormalization(mergeChunks(chunks, nChunks));
+        FitTrace::instance().count("normalisation evaluations", evaluations);
+        return evaluations;
+    }
+
+    const std::vector<double> &normalizationMatrix() const { return norm_; }
+
+    // Integral of |A|^2 over the normalisation grid
+    double normalization(const double *re, const double *im) const {
+        const size_t n = numKnots();
+        double sum     = 0;
+        for(size_t k = 0; k < n; k++) {
+            double mr = 0, mi = 0;
+            for(size_t l = 0; l < n; l++) {
+                mr += norm_[k * n + l] * re[l];
+                mi += norm_[k * n + l] * im[l];
+            }
+            sum += re[k] * mr + im[k] * mi;
+        }
+        return sum;
+    }
+
+    // -sum w_e log |A_e|^2 + W log(norm), W the sum of weights (N unweighted). The
+    // coefficients are mapped once to the 2n (y, y2) vector; the events are then a batched
+    // complex product with the basis table followed by a log-reduce, in fixed-size blocks so
+    // the sum does not depend on the thread count.
+    // With gre/gim the analytic gradient with respect to re/im is filled in the same pass.
+    double nll(const double *re, const double *im, double *gre = nullptr, double *gim = nullptr) const {
+        FitTrace::Scope scope("nll");
+        const size_t n  = numKnots();
+        const size_t n2 = 2 * n;
+        std::vector<double> cr(n2), ci(n2);
+        {
+            FitTrace::Scope phase("nll/coefficients");
+            std::copy(re, re + n, cr.begin());
+            std::copy(im, im + n, ci.begin());
+            basis_.secondDerivatives(re, cr.data() + n);
+            basis_.secondDerivatives(im, ci.data() + n);
+        }
+
+        if(binned())
+            return binnedNll(cr.data(), ci.data(), gre, gim);
+
+        const bool grad      = gre && gim;
+        const size_t nBlocks = localBlocks();
+        std::vector<double> partial(nBlocks, 0.0);
+        std::vector<double> partialGrad(grad ? nBlocks * 2 * n2 : 0, 0.0);
+
+        {
+            FitTrace::Scope phase("nll/events");
+#pragma omp parallel for schedule(static)
+            for(long blk = 0; blk < (long)nBlocks; blk++) {
+                size_t begin = blk * blockSize;
+                size_t end   = std::min<size_t>(nEvents_, begin + blockSize);
+                double *g = grad ? &partialGrad[blk * 2 * n2] : nullptr;
+                if(single_)
+                    partial[blk] = blockLogSum(weightsF_.data(), begin, end, cr.data(), ci.data(), g);
+                else
+                    partial[blk] = blockLogSum(weights_.data(), begin, end, cr.data(), ci.data(), g);
+            }
+        }
+        FitTrace::instance().count("events evaluated", nEvents_);
+
+        // The blocks held here are reduced in block order; across processes the value and the
+        // (y, y2) gradient then take one sum of 1 + 4n values
+        double sum = compensatedSum(partial);
+        std::vector<double> g(grad ? 2 * n2 : 0, 0.0);
+        for(size_t blk = 0; grad && blk < nBlocks; blk++)
+            for(size_t k = 0; k < 2 * n2; k++)
+                g[k] += partialGrad[blk * 2 * n2 + k];
+
+        if(exchange_) {
+            FitTrace::Scope phase("nll/exchange");
+            g.push_back(sum);
+            exchange_->sum(g.data(), g.size());
+            sum = g.back();
+            g.pop_back();
+        }
+
+        double norm;
+        {
+            FitTrace::Scope phase("nll/normalisation");
+            norm = normalization(re, im);
+        }
+
+        if(grad) {
+            FitTrace::Scope phase("nll/gradient");
+            // d(-log|A|^2) in (y, y2) space, then back to knot space
+            knotGradient(g.data(), gre, gim);
+
+            for(size_t k = 0; k < n; k++) {
+                double mr = 0, mi = 0;
+                for(size_t l = 0; l < n; l++) {
+                    mr += norm_[k * n + l] * re[l];
+                    mi += norm_[k * n + l] * im[l];
+                }
+                gre[k] += 2 * weightSum_ * mr / norm;
+                gim[k] += 2 * weightSum_ * mi / norm;
+            }
+        }
+
+        return sum + weightSum_ * std::log(norm);
+    }
+
+    // Covariance of the per-event scores, C = sum_e w_e^2 s_e s_e^T with s_e the gradient of
+    // -log|A_e|^2 + log(norm), as a row-major 2n x 2n matrix over (re, im). For a weighted fit
+    // the errors are the sandwich H^-1 C H^-1, H the Hessian of nll(); unweighted, C = H on
+    // average. The event part is accumulated in the (y, y2) space, where each score has 16
+    // entries, and mapped to knot space once; the normalisation part is the same for every
+    // event and is added in closed form.
+    std::vector<double> scoreCovariance(const double *re, const double *im) const {
+        FitTrace::Scope scope("score covariance");
+        const size_t n  = numKnots();
+        const size_t n2 = 2 * n;
+        const size_t n4 = 2 * n2;
+        std::vector<double> cr(n2), ci(n2);
+        std::copy(re, re + n, cr.begin());
+        std::copy(im, im + n, ci.begin());
+        basis_.secondDerivatives(re, cr.data() + n);
+        basis_.secondDerivatives(im, ci.data() + n);
+
+        // Fixed chunks summed in order keep the result independent of the thread count
+        const size_t nChunks = std::max<size_t>(1, std::min<size_t>(64, nEvents_ / blockSize));
+        std::vector<double> chunks(nChunks * (n4 * n4 + n4 + 1), 0.0);
+
+#pragma omp parallel for schedule(static)
+        for(long c = 0; c < (long)nChunks; c++) {
+            double *gg = &chunks[c * (n4 * n4 + n4 + 1)];
+            double *g1 = gg + n4 * n4;
+            double *w2 = g1 + n4;
+            size_t idx[16];
+            double s[16];
+
+            for(size_t e = c * nEvents_ / nChunks; e < (c + 1) * nEvents_ / nChunks; e++) {
+                double ar, ai;
+                amplitude(e, cr.data(), ci.data(), ar, ai);
+                double a2 = ar * ar + ai * ai;
+                double we = eventWeight_.empty() ? 1.0 : eventWeight_[e];
+                double fr = -2 * ar / a2;
+                double fi = -2 * ai / a2;
+
+                double w[8];
+                pointIndices(e, idx, w);
+                for(int k = 0; k < 8; k++) {
+                    idx[8 + k] = n2 + idx[k];
+                    s[k]       = fr * w[k];
+                    s[8 + k]   = fi * w[k];
+                }
+                for(int a = 0; a < 16; a++) {
+                    g1[idx[a]] += we * we * s[a];
+                    for(int b = 0; b < 16; b++)
+                        gg[idx[a] * n4 + idx[b]] += we * we * s[a] * s[b];
+                }
+                *w2 += we * we;
+            }
+        }
+
+        std::vector<double> g(n4 * n4 + n4 + 1, 0.0);
+        for(size_t c = 0; c < nChunks; c++)
+            for(size_t k = 0; k < g.size(); k++)
+                g[k] += chunks[c * g.size() + k];
+        if(exchange_)
+            exchange_->sum(g.data(), g.size());
+        const double *g1 = &g[n4 * n4];
+        const double w2  = g[n4 * n4 + n4];
+
+        // B (4n x 2n) takes (re, im) to the (y, y2) space: [1; D] on each part
+        const std::vector<double> &d = basis_.derivativeMatrix();
+        std::vector<double> b(n4 * n2, 0.0);
+        for(size_t part = 0; part < 2; part++)
+            for(size_t k = 0; k < n; k++) {
+                b[(part * n2 + k) * n2 + part * n + k] = 1;
+                for(size_t l = 0; l < n; l++)
+                    b[(part * n2 + n + k) * n2 + part * n + l] = d[k * n + l];
+            }
+
+        std::vector<double> gb(n4 * n2, 0.0), cov(n2 * n2, 0.0), s1(n2, 0.0), sn(n2, 0.0);
+        for(size_t i = 0; i < n4; i++)
+            for(size_t k = 0; k < n4; k++)
+                if(g[i * n4 + k] != 0)
+                    for(size_t j = 0; j < n2; j++)
+                        gb[i * n2 + j] += g[i * n4 + k] * b[k * n2 + j];
+        for(size_t i = 0; i < n2; i++) {
+            for(size_t k = 0; k < n4; k++) {
+                s1[i] += b[k * n2 + i] * g1[k];
+                for(size_t j = 0; j < n2; j++)
+                    cov[i * n2 + j] += b[k * n2 + i] * gb[k * n2 + j];
+            }
+        }
+
+        // d log(norm) = 2 M (re, im) / norm
+        double norm = normalization(re, im);
+        for(size_t k = 0; k < n; k++)
+            for(size_t l = 0; l < n; l++) {
+                sn[k] += 2 * norm_[k * n + l] * re[l] / norm;
+                sn[n + k] += 2 * norm_[k * n + l] * im[l] / norm;
+            }
+        for(size_t i = 0; i < n2; i++)
+            for(size_t j = 0; j < n2; j++)
+                cov[i * n2 + j] += s1[i] * sn[j] + sn[i] * s1[j] + w2 * sn[i] * sn[j];
+
+        return cov;
+    }
+
+  private:
+    // The basis table of setEvents(), for events or binned-mode rule points
+    void buildTable(const std::vector<double> &s12, const std::vector<double> &s13) {
+        FitTrace::Scope scope("basis table");
+        nEvents_ = s12.size();
+        // Fresh allocations, so the pages are placed by the fill below
+        lo12_     = TableVector<uint32_t>();
+        lo13_     = TableVector<uint32_t>();
+        weights_  = TableVector<double>();
+        weightsF_ = TableVector<float>();
+        lo12_.resize(nEvents_);
+        lo13_.resize(nEvents_);
+        if(single_)
+            weightsF_.resize(8 * nEvents_);
+        else
+            weights_.resize(8 * nEvents_);
+
+        // Every entry is written here, by the thread that owns its block in nll()
+        forEachBlock(nEvents_, [&](size_t begin, size_t end) {
+            for(size_t e = begin; e < end; e++) {
+                size_t idx[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+                double w[8]   = {0, 0, 0, 0, 0, 0, 0, 0};
+                // A mass outside the knot range keeps zero weights, as the Spline amplitude does
+                pointWeights(s12[e], s13[e], idx, w);
+                lo12_[e] = idx[0];
+                lo13_[e] = idx[4];
+                for(int k = 0; k < 8; k++) {
+                    if(single_)
+                        weightsF_[k * nEvents_ + e] = w[k];
+                    else
+                        weights_[k * nEvents_ + e] = w[k];
+                }
+            }
+        });
+
+        FitTrace::instance().memory("basis table",
+                                    nEvents_ * (8 * (single_ ? sizeof(float) : sizeof(double)) + 2 * sizeof(uint32_t)));
+    }
+
+    static const size_t blockSize = 4096;
+    static const size_t binBlockSize = 256;
+
+    // Maps a gradient in the 2n (y, y2) space (2 x 2n, real part first) to knot space with
+    // B^T = [1, D^T]
+    void knotGradient(const double *g, double *gre, double *gim) const {
+        const size_t n  = numKnots();
+        const size_t n2 = 2 * n;
+
+        const std::vector<double> &d = basis_.derivativeMatrix();
+        for(size_t k = 0; k < n; k++) {
+            double dr = 0, di = 0;
+            for(size_t l = 0; l < n; l++) {
+                dr += d[l * n + k] * g[n + l];
+                di += d[l * n + k] * g[n2 + n + l];
+            }
+            gre[k] = g[k] + dr;
+            gim[k] = g[n2 + k] + di;
+        }
+    }
+
+    // The binned-mode likelihood (see setBinnedEvents()) from the (y, y2) vectors cr/ci. The
+    // bins are reduced in fixed blocks; the gradient is (N / I) dI - sum_b n_b / I_b dI_b, with
+    // dI and the second sum accumulated separately because I is only known at the end.
+    double binnedNll(const double *cr, const double *ci, double *gre, double *gim) const {
+        const size_t n2      = 2 * numKnots();
+        const bool grad      = gre && gim;
+        const size_t nBins   = binCount_.size();
+        const size_t nBlocks = (nBins + binBlockSize - 1) / binBlockSize;
+        std::vector<double> partialLog(nBlocks, 0.0), partialInt(nBlocks, 0.0);
+        std::vector<double> partialGrad(grad ? nBlocks * 4 * n2 : 0, 0.0);
+
+        {
+            FitTrace::Scope phase("nll/bins");
+#pragma omp parallel for schedule(static)
+            for(long blk = 0; blk < (long)nBlocks; blk++) {
+                double *gInt = grad ? &partialGrad[blk * 4 * n2] : nullptr;
+                double *gLog = grad ? gInt + 2 * n2 : nullptr;
+                for(size_t b = blk * binBlockSize; b < std::min(nBins, (blk + 1) * binBlockSize); b++) {
+                    double integral = 0;
+                    for(size_t p = binFirst_[b]; p < binFirst_[b + 1]; p++) {
+                        double ar, ai;
+                        amplitude(p, cr, ci, ar, ai);
+                        integral += pointWeight_[p] * (ar * ar + ai * ai);
+                    }
+                    partialInt[blk] += integral;
+                    if(binCount_[b] > 0)
+                        partialLog[blk] -= binCount_[b] * std::log(integral);
+
+                    if(!grad)
+                        continue;
+                    double ratio = binCount_[b] > 0 ? binCount_[b] / integral : 0;
+                    for(size_t p = binFirst_[b]; p < binFirst_[b + 1]; p++) {
+                        double ar, ai;
+                        amplitude(p, cr, ci, ar, ai);
+                        double fr = 2 * pointWeight_[p] * ar;
+                        double fi = 2 * pointWeight_[p] * ai;
+                        size_t idx[8];
+                        double w[8];
+                        pointIndices(p, idx, w);
+                        for(int k = 0; k < 8; k++) {
+                            gInt[idx[k]] += fr * w[k];
+                            gInt[n2 + idx[k]] += fi * w[k];
+                            gLog[idx[k]] += ratio * fr * w[k];
+                            gLog[n2 + idx[k]] += ratio * fi * w[k];
+                        }
+                    }
+                }
+            }
+        }
+        FitTrace::instance().count("bins evaluated", nBins);
+
+        double sum   = compensatedSum(partialLog);
+        double total = compensatedSum(partialInt);
+
+        if(grad) {
+            FitTrace::Scope phase("nll/gradient");
+            std::vector<double> g(2 * n2, 0.0);
+            for(size_t blk = 0; blk < nBlocks; blk++)
+                for(size_t k = 0; k < 2 * n2; k++)
+                    g[k] += binTotal_ / total * partialGrad[blk * 4 * n2 + k] - partialGrad[blk * 4 * n2 + 2 * n2 + k];
+            knotGradient(g.data(), gre, gim);
+        }
+
+        return sum + binTotal_ * std::log(total);
+    }
+
+    // 3x3 Gauss-Legendre nodes of [x0,x1]x[y0,y1] inside the phase space, with their weights;
+    // the one rule of the normalisation grids, the binned-mode points and the adaptive cells
+    template <typename F>
+    void forEachRuleNode(double x0, double x1, double y0, double y1, const std::function<bool(double, double)> &inside,
+                         F f) const {
+        static const double gx[3] = {-0.7745966692414834, 0.0, 0.7745966692414834};
+        static const double gw[3] = {5.0 / 9.0, 8.0 / 9.0, 5.0 / 9.0};
+        double hx = 0.5 * (x1 - x0), hy = 0.5 * (y1 - y0);
+        for(int a = 0; a < 3; a++)
+            for(int b = 0; b < 3; b++) {
+                double x = x0 + hx * (1 + gx[a]);
+                double y = y0 + hy * (1 + gx[b]);
+                if(inside(x, y))
+                    f(x, y, hx * hy * gw[a] * gw[b]);
+            }
+    }
+
+    // Table indices and weights of row e, as pointWeights() gave them
+    void pointIndices(size_t e, size_t idx[8], double w[8]) const {
+        const size_t n    = numKnots();
+        size_t base[2]    = {lo12_[e], lo13_[e]};
+        for(int c = 0; c < 2; c++) {
+            idx[4 * c + 0] = base[c];
+            idx[4 * c + 1] = base[c] + 1;
+            idx[4 * c + 2] = n + base[c];
+            idx[4 * c + 3] = n + base[c] + 1;
+            for(int k = 0; k < 4; k++)
+                w[4 * c + k] = single_ ? weightsF_[(4 * c + k) * nEvents_ + e]
+                                       : weights_[(4 * c + k) * nEvents_ + e];
+        }
+    }
+
+    struct Cell {
+        double x0, x1, y0, y1;
+        double value   = 0; // quadrant rule
+        double error   = 0; // |quadrant rule - whole-cell rule|
+        bool touches   = false;
+        bool straddles = false;
+        bool diagonal  = false; // symmetric mode: square cell centred on s12 = s13
+        double weight  = 1;     // symmetric mode: 2 for cells standing in for their mirror
+
+        double area() const { return (x1 - x0) * (y1 - y0); }
+    };
+
+    // Whether a grid is folded in symmetric mode
+    bool folded(size_t nx, double x0, double x1, size_t ny, double y0, double y1) const {
+        return symmetric_ && nx == ny && x0 == y0 && x1 == y1;
+    }
+
+    // M = B^T G B from the overlaps G accumulated in the 2n (y, y2) space
+    void setNormalization(const std::vector<double> &g) {
+        FitTrace::instance().memory("normalisation matrix", (g.size() + numKnots() * numKnots()) * sizeof(double));
+        const size_t n  = numKnots();
+        const size_t n2 = 2 * n;
+
+        const std::vector<double> &d = basis_.derivativeMatrix();
+        std::vector<double> bmat(n2 * n, 0.0);
+        for(size_t i = 0; i < n; i++) {
+            bmat[i * n + i] = 1;
+            for(size_t j = 0; j < n; j++)
+                bmat[(n + i) * n + j] = d[i * n + j];
+        }
+
+        std::vector<double> gb(n2 * n, 0.0);
+        for(size_t a = 0; a < n2; a++)
+            for(size_t b = 0; b < n2; b++)
+                if(g[a * n2 + b] != 0)
+                    for(size_t l = 0; l < n; l++)
+                        gb[a * n + l] += g[a * n2 + b] * bmat[b * n + l];
+
+        norm_.assign(n * n, 0.0);
+        for(size_t a = 0; a < n2; a++)
+            for(size_t k = 0; k < n; k++)
+                if(bmat[a * n + k] != 0)
+                    for(size_t l = 0; l < n; l++)
+                        norm_[k * n + l] += bmat[a * n + k] * gb[a * n + l];
+    }
+
+    // forEachRuleNode() points with a mass inside the knot range, as basis indices and weights
+    template <typename F>
+    void forEachRulePoint(double x0, double x1, double y0, double y1, const std::function<bool(double, double)> &inside,
+                          F f, bool &touches) const {
+        size_t idx[8];
+        double w[8];
+        forEachRuleNode(x0, x1, y0, y1, inside, [&](double x, double y, double weight) {
+            touches = true;
+            if(pointWeights(x, y, idx, w))
+                f(idx, w, weight);
+        });
+    }
+
+    // Points of the quadrant rule of a cell
+    template <typename F>
+    void forEachPoint(const Cell &c, const std::function<bool(double, double)> &inside, F f, bool &touches) const {
+        double xm = 0.5 * (c.x0 + c.x1), ym = 0.5 * (c.y0 + c.y1);
+        forEachRulePoint(c.x0, xm, c.y0, ym, inside, f, touches);
+        forEachRulePoint(xm, c.x1, c.y0, ym, inside, f, touches);
+        forEachRulePoint(c.x0, xm, ym, c.y1, inside, f, touches);
+        forEachRulePoint(xm, c.x1, ym, c.y1, inside, f, touches);
+    }
+
+    void evaluateCell(Cell &c, const std::function<bool(double, double)> &inside, const double *cr,
+                      const double *ci) const {
+        auto density = [&](double &sum) {
+            return [&](const size_t idx[8], const double w[8], double weight) {
+                double ar = 0, ai = 0;
+                for(int k = 0; k < 8; k++) {
+                    ar += w[k] * cr[idx[k]];
+                    ai += w[k] * ci[idx[k]];
+                }
+                sum += weight * (ar * ar + ai * ai);
+            };
+        };
+
+        double whole = 0, quads = 0;
+        bool touches = false;
+        forEachRulePoint(c.x0, c.x1, c.y0, c.y1, inside, density(whole), touches);
+        forEachPoint(c, inside, density(quads), touches);
+
+        // The rule does not see where the boundary crosses a cell, so a cut cell is charged a
+        // fraction of its value; one straddling the boundary with no rule point inside yet
+        // must still be split
+        int corners = inside(c.x0, c.y0) + inside(c.x1, c.y0) + inside(c.x0, c.y1) + inside(c.x1, c.y1);
+
+        c.value     = quads;
+        c.error     = std::fabs(quads - whole);
+        if(corners != 4)
+            c.error = std::max(c.error, 0.05 * quads);
+        c.straddles = !touches && corners > 0;
+        c.touches   = touches || corners > 0;
+    }
+
+    // Indices and weights of the point in the 2n (y, y2) space. A mass outside the knot range
+    // contributes nothing, as in the Spline amplitude S(s12) + S(s13), and keeps zero weights
+    // on knot 0; false when both are outside.
+    bool pointWeights(double x, double y, size_t idx[8], double w[8]) const {
+        const size_t n = numKnots();
+        const double s[2] = {x, y};
+        bool any = false;
+        for(int c = 0; c < 2; c++) {
+            size_t lo = 0;
+            if(basis_.locate(s[c], lo)) {
+                basis_.localWeights(s[c], lo, w + 4 * c);
+                any = true;
+            } else {
+                std::fill(w + 4 * c, w + 4 * c + 4, 0.0);
+            }
+            idx[4 * c + 0] = lo;
+            idx[4 * c + 1] = lo + 1;
+            idx[4 * c + 2] = n + lo;
+            idx[4 * c + 3] = n + lo + 1;
+        }
+        return any;
+    }
+
+    // Sum of the values with Neumaier compensation, in order
+    static double compensatedSum(const std::vector<double> &values) {
+        double sum = 0, c = 0;
+        for(double v : values) {
+            double t = sum + v;
+            c += std::fabs(sum) >= std::fabs(v) ? (sum - t) + v : (v - t) + sum;
+            sum = t;
+        }
+        return sum + c;
+    }
+
+    // Event blocks of the whole sample, and those held here (all of them unless distributed)
+    size_t globalBlocks() const {
+        return ((exchange_ ? totalEvents_ : nEvents_) + blockSize - 1) / blockSize;
+    }
+    size_t localBlocks() const { return (nEvents_ + blockSize - 1) / blockSize; }
+
+    // Runs f(begin, end) on the blockSize blocks of [0, n) with the static schedule of the
+    // event loops, so a block is always handled by the same thread
+    template <typename F>
+    static void forEachBlock(size_t n, F f) {
+        const size_t nBlocks = (n + blockSize - 1) / blockSize;
+#pragma omp parallel for schedule(static)
+        for(long blk = 0; blk < (long)nBlocks; blk++)
+            f(blk * blockSize, std::min<size_t>(n, (blk + 1) * blockSize));
+    }
+
+    // Element-wise compensated sum of nChunks equal-sized chunks, in chunk order
+    static std::vector<double> mergeChunks(const std::vector<double> &chunks, size_t nChunks) {
+        const size_t size = chunks.size() / nChunks;
+        std::vector<double> merged(size), column(nChunks);
+        for(size_t k = 0; k < size; k++) {
+            for(size_t c = 0; c < nChunks; c++)
+                column[c] = chunks[c * size + k];
+            merged[k] = compensatedSum(column);
+        }
+        return merged;
+    }
+
+    // Complex amplitude of event e from the (y, y2) vectors cr/ci
+    void amplitude(size_t e, const double *cr, const double *ci, double &ar, double &ai) const {
+        if(single_)
+            amplitude(weightsF_.data(), e, cr, ci, ar, ai);
+        else
+            amplitude(weights_.data(), e, cr, ci, ar, ai);
+    }
+
+    // As above, on the table w in either precision; the products are formed in double
+    template <typename T>
+    void amplitude(const T *w, size_t e, const double *cr, const double *ci, double &ar, double &ai) const {
+        const size_t n   = numKnots();
+        const size_t a   = lo12_[e];
+        const size_t b   = lo13_[e];
+        const size_t str = nEvents_;
+
+        ar = w[e] * cr[a] + w[str + e] * cr[a + 1] + w[2 * str + e] * cr[n + a] + w[3 * str + e] * cr[n + a + 1]
+             + w[4 * str + e] * cr[b] + w[5 * str + e] * cr[b + 1] + w[6 * str + e] * cr[n + b]
+             + w[7 * str + e] * cr[n + b + 1];
+        ai = w[e] * ci[a] + w[str + e] * ci[a + 1] + w[2 * str + e] * ci[n + a] + w[3 * str + e] * ci[n + a + 1]
+             + w[4 * str + e] * ci[b] + w[5 * str + e] * ci[b + 1] + w[6 * str + e] * ci[n + b]
+             + w[7 * str + e] * ci[n + b + 1];
+    }
+
+    // -sum w_e log |A_e|^2 over events [begin, end) of the table w; with g, also adds
+    // d(-w_e log|A_e|^2)/d(cr, ci) to g (2 x 2n, real part first)
+    template <typename T>
+    double blockLogSum(const T *w, size_t begin, size_t end, const double *cr, const double *ci, double *g) const {
+        if(g)
+            return blockLogSumGrad(w, begin, end, cr, ci, g);
+
+        double sum = 0;
+        if(!eventWeight_.empty()) {
+            const double *we = eventWeight_.data();
+#pragma omp simd reduction(+ : sum)
+            for(size_t e = begin; e < end; e++) {
+                double ar, ai;
+                amplitude(w, e, cr, ci, ar, ai);
+                sum -= we[e] * std::log(ar * ar + ai * ai);
+            }
+            return sum;
+        }
+#pragma omp simd reduction(+ : sum)
+        for(size_t e = begin; e < end; e++) {
+            double ar, ai;
+            amplitude(w, e, cr, ci, ar, ai);
+            sum -= std::log(ar * ar + ai * ai);
+        }
+        return sum;
+    }
+
+    template <typename T>
+    double blockLogSumGrad(const T *w, size_t begin, size_t end, const double *cr, const double *ci, double *g) const {
+        const size_t n  = numKnots();
+        const size_t n2 = 2 * n;
+        double sum      = 0;
+
+        for(size_t e = begin; e < end; e++) {
+            double ar, ai;
+            amplitude(w, e, cr, ci, ar, ai);
+            double a2 = ar * ar + ai * ai;
+            double we = eventWeight_.empty() ? 1.0 : eventWeight_[e];
+            sum -= we * std::log(a2);
+
+            double fr  = -2 * we * ar / a2;
+            double fi  = -2 * we * ai / a2;
+            size_t base[2] = {lo12_[e], lo13_[e]};
+            for(int c = 0; c < 2; c++) {
+                size_t idx[4] = {base[c], base[c] + 1, n + base[c], n + base[c] + 1};
+                for(int k = 0; k < 4; k++) {
+                    double wk = w[(4 * c + k) * nEvents_ + e];
+                    g[idx[k]] += fr * wk;
+                    g[n2 + idx[k]] += fi * wk;
+                }
+            }
+        }
+        return sum;
+    }
+
+    SplineBasis basis_;
+    size_t nEvents_ = 0;
+    TableVector<uint32_t> lo12_;
+    TableVector<uint32_t> lo13_;
+    TableVector<double> weights_;
+    TableVector<float> weightsF_; // single-precision table, see setSinglePrecision()
+    std::vector<double> norm_;
+    TableVector<double> eventWeight_; // empty: unweighted
+    double weightSum_ = 0;
+    bool symmetric_   = false;
+    bool single_      = false;
+    const BlockExchange *exchange_ = nullptr;
+    size_t firstEvent_  = 0;
+    size_t totalEvents_ = 0;
+    std::vector<size_t> binFirst_;     // binned mode: rule points of bin b are [binFirst_[b], binFirst_[b+1])
+    std::vector<double> binCount_;
+    std::vector<double> pointWeight_;
+    double binTotal_ = 0;
+};